@@ -1,9 +1,15 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
-// in memory reduces the number of disk reads and also provides
-// a synchronization point for disk blocks used by multiple processes.
+// The buffer cache holds cached copies of disk block contents in a
+// hash table keyed on (dev, blockno).  Caching disk blocks in memory
+// reduces the number of disk reads and also provides a synchronization
+// point for disk blocks used by multiple processes.
+//
+// Each hash bucket has its own lock, so lookups of different blocks
+// proceed in parallel; a global eviction lock serializes only the
+// miss path that recycles buffers between buckets.  Replacement is
+// least-recently-used, approximated by a per-buffer timestamp taken
+// at brelse time.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
@@ -25,67 +31,166 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
+
+#define NBUCKET 13
+#define HASH(dev, blockno) (((dev) ^ (blockno)) % NBUCKET)
 
 struct {
-  struct spinlock lock;
   struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Serializes recycling of buffers between buckets, so a block is
+  // never inserted twice and at most one bucket lock is held at a time.
+  struct spinlock evictlock;
+
+  // Hash buckets, chained through buf->next.
+  struct {
+    struct spinlock lock;
+    struct buf *head;
+  } bucket[NBUCKET];
 } bcache;
 
+// Count of bawrite()s still on their way to the disk; bawaitall()
+// sleeps here until the interrupt handler has finished them all.
+static struct {
+  struct spinlock lock;
+  int pending;
+} bawrites;
+
 void binit(void) {
   struct buf *b;
+  int i;
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bawrites.lock, "bawrite");
+  initlock(&bcache.evictlock, "bcache");
+  for (i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Place all buffers in bucket 0; they migrate on first use.  Each
+  // buffer's storage is a full page so it can double as a user-
+  // mappable frame.
   for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    if ((b->data = (uchar *)kalloc()) == 0)
+      panic("binit: no pages");
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
   }
 }
 
+// Unlink b from its current hash bucket.
+// Caller must hold that bucket's lock.
+static void bunlink(struct buf *b) {
+  struct buf **pp;
+
+  for (pp = &bcache.bucket[HASH(b->dev, b->blockno)].head; *pp;
+       pp = &(*pp)->next) {
+    if (*pp == b) {
+      *pp = b->next;
+      return;
+    }
+  }
+  panic("bunlink");
+}
+
+// Search one bucket for (dev, blockno).
+// Caller must hold the bucket's lock.
+static struct buf *bfind(int h, uint dev, uint blockno) {
+  struct buf *b;
+
+  for (b = bcache.bucket[h].head; b; b = b->next)
+    if (b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf *bget(uint dev, uint blockno) {
-  struct buf *b;
+  struct buf *b, *lru;
+  int h, i;
 
-  acquire(&bcache.lock);
+  h = HASH(dev, blockno);
 
   // Is the block already cached?
-  for (b = bcache.head.next; b != &bcache.head; b = b->next) {
-    if (b->dev == dev && b->blockno == blockno) {
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.bucket[h].lock);
+  if ((b = bfind(h, dev, blockno)) != 0) {
+    b->refcnt++;
+    fsstat.bhit++;
+    release(&bcache.bucket[h].lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bcache.bucket[h].lock);
+
+  // Not cached; recycle the least recently used unused buffer.
+  // The eviction lock serializes this path, so once we re-check the
+  // bucket nobody else can insert the same block behind our back.
+  acquire(&bcache.evictlock);
+  acquire(&bcache.bucket[h].lock);
+  if ((b = bfind(h, dev, blockno)) != 0) {
+    b->refcnt++;
+    fsstat.bhit++;
+    release(&bcache.bucket[h].lock);
+    release(&bcache.evictlock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bcache.bucket[h].lock);
 
-  // Not cached; recycle an unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-    if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // The scan runs without the bucket locks, so a hit in the fast path
+  // above can revive a candidate's refcnt 0->1 after we pick it;
+  // re-check under its bucket lock and rescan if we lost that race.
+  for (;;) {
+    lru = 0;
+    for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+      if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0 &&
+          (lru == 0 || b->lastuse < lru->lastuse))
+        lru = b;
     }
+    if (lru == 0)
+      panic("bget: no buffers");
+    i = HASH(lru->dev, lru->blockno);
+    acquire(&bcache.bucket[i].lock);
+    if (lru->refcnt == 0 && (lru->flags & B_DIRTY) == 0)
+      break;
+    release(&bcache.bucket[i].lock);
+  }
+
+  fsstat.bmiss++;
+  if (lru->flags & B_VALID)
+    fsstat.brecycle++;
+
+  b = lru;
+  bunlink(b);
+  release(&bcache.bucket[i].lock);
+
+  // If the old page was handed out by bmappage() and is still mapped
+  // somewhere, leave it to its mappers (they hold references; kfree
+  // only drops ours) and start the buffer over on a fresh page.
+  if (krefcount((char *)b->data) > 1) {
+    uchar *pg = (uchar *)kalloc();
+    if (pg == 0)
+      panic("bget: no pages");
+    kfree((char *)b->data);
+    b->data = pg;
   }
-  panic("bget: no buffers");
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+
+  acquire(&bcache.bucket[h].lock);
+  b->next = bcache.bucket[h].head;
+  bcache.bucket[h].head = b;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.evictlock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -99,6 +204,108 @@ struct buf *bread(uint dev, uint blockno) {
   return b;
 }
 
+// Zero-copy handoff of a cached block to the VM: return the block's
+// page with an extra reference so it can be mapped into user space.
+// The mapping stays coherent with the cache — file writes through
+// writei land in the same frame — and survives buffer recycling,
+// because bget() gives a recycled buf a fresh page rather than
+// reclaiming a mapped one.
+char *bmappage(uint dev, uint blockno) {
+  struct buf *b;
+  char *pg;
+
+  b = bread(dev, blockno);
+  pg = (char *)b->data;
+  krefinc(pg);
+  brelse(b);
+  return pg;
+}
+
+// Look up a block without bringing it into the cache: return the
+// locked buffer if the block is already cached, 0 — with no
+// recycling — if not.  Lets O_DIRECT transfers stay coherent with
+// cached copies while a streaming scan leaves the cache alone.
+struct buf *bpeek(uint dev, uint blockno) {
+  struct buf *b;
+  int h = HASH(dev, blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  if ((b = bfind(h, dev, blockno)) != 0)
+    b->refcnt++;
+  release(&bcache.bucket[h].lock);
+  if (b) {
+    acquiresleep(&b->lock);
+    if ((b->flags & B_VALID) == 0)
+      iderw(b);
+  }
+  return b;
+}
+
+// Transfer one block between the disk and a caller-supplied page
+// through a transient buffer that is never inserted into the cache.
+// Synchronous; the O_DIRECT workhorse.
+void bdirect(uint dev, uint blockno, char *data, int dirty) {
+  struct buf b;
+
+  memset(&b, 0, sizeof(b));
+  initsleeplock(&b.lock, "bdirect");
+  acquiresleep(&b.lock);
+  b.dev = dev;
+  b.blockno = blockno;
+  b.data = (uchar *)data;
+  b.flags = dirty ? B_DIRTY : 0;
+  b.refcnt = 1;
+  iderw(&b);
+  releasesleep(&b.lock);
+}
+
+// Stage a block into the cache without waiting for the disk: the
+// read is queued and the buffer is unlocked and released from the
+// interrupt handler (basyncdone).  Used for readahead.  Does nothing
+// if the block is already present.
+void bprefetch(uint dev, uint blockno) {
+  struct buf *b;
+  int h = HASH(dev, blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  b = bfind(h, dev, blockno);
+  release(&bcache.bucket[h].lock);
+  if (b)
+    return;
+
+  b = bget(dev, blockno);
+  if (b->flags & B_VALID) {
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  iderw(b); // returns immediately for async buffers
+}
+
+// Finish an asynchronous read or write: unlock the buffer and drop
+// the reference taken when it was staged.  Called from ideintr, so no
+// holdingsleep check — the issuing process is not waiting on the buf.
+void basyncdone(struct buf *b) {
+  int h, awrite;
+
+  awrite = b->flags & B_AWRITE;
+  b->flags &= ~(B_ASYNC | B_AWRITE);
+  releasesleep(&b->lock);
+
+  h = HASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
+  b->refcnt--;
+  b->lastuse = ticks;
+  release(&bcache.bucket[h].lock);
+
+  if (awrite) {
+    acquire(&bawrites.lock);
+    if (--bawrites.pending == 0)
+      wakeup(&bawrites);
+    release(&bawrites.lock);
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b) {
   if (!holdingsleep(&b->lock))
@@ -107,27 +314,45 @@ void bwrite(struct buf *b) {
   iderw(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the MRU list.
+// Queue a write of b and return without waiting; the buffer is
+// unlocked and released by the interrupt handler (basyncdone), so the
+// caller must not touch it again.  Writes queued back to back sort
+// into the disk elevator together, where adjacent blocks merge into
+// one transfer.  Pair with bawaitall() to order later writes after
+// the whole batch.
+void bawrite(struct buf *b) {
+  if (!holdingsleep(&b->lock))
+    panic("bawrite");
+  acquire(&bawrites.lock);
+  bawrites.pending++;
+  release(&bawrites.lock);
+  b->flags |= B_DIRTY | B_ASYNC | B_AWRITE;
+  iderw(b); // returns immediately for async buffers
+}
+
+// Wait until every bawrite() issued so far has reached the disk: the
+// write barrier between a batch and whatever must follow it.
+void bawaitall(void) {
+  acquire(&bawrites.lock);
+  while (bawrites.pending > 0)
+    sleep(&bawrites, &bawrites.lock);
+  release(&bawrites.lock);
+}
+
+// Release a locked buffer and update its LRU timestamp.
 void brelse(struct buf *b) {
+  int h;
+
   if (!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  h = HASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-
-  release(&bcache.lock);
+  b->lastuse = ticks;
+  release(&bcache.bucket[h].lock);
 }
 // PAGEBREAK!
 // Blank page.
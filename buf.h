@@ -4,10 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint lastuse;      // tick of last brelse, for LRU replacement
+  struct buf *next;  // bcache hash bucket chain
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  // One whole kalloc'd page (BSIZE == PGSIZE), so a cached file
+  // block can be handed to the VM and mapped into user space
+  // without copying; see bmappage() in bio.c.
+  uchar *data;
 };
 #define B_VALID 0x2 // buffer has been read from disk
 #define B_DIRTY 0x4 // buffer needs to be written to disk
+#define B_ASYNC 0x8  // readahead: completed and released by ideintr
+#define B_AWRITE 0x10 // bawrite() in flight; counted for bawaitall()
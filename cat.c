@@ -2,13 +2,14 @@
 #include "stat.h"
 #include "user.h"
 
-char buf[512];
+char buf[FBUFSIZE];
+FILE *out;
 
-void cat(int fd) {
+void cat(FILE *f) {
   int n;
 
-  while ((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) {
+  while ((n = fread(f, buf, sizeof(buf))) > 0) {
+    if (fwrite(out, buf, n) != n) {
       printf(1, "cat: write error\n");
       exit();
     }
@@ -20,20 +21,24 @@ void cat(int fd) {
 }
 
 int main(int argc, char *argv[]) {
-  int fd, i;
+  FILE *f;
+  int i;
 
+  out = fdopen(1, "w");
   if (argc <= 1) {
-    cat(0);
+    cat(fdopen(0, "r"));
+    fflush(out);
     exit();
   }
 
   for (i = 1; i < argc; i++) {
-    if ((fd = open(argv[i], 0)) < 0) {
+    if ((f = fopen(argv[i], "r")) == 0) {
       printf(1, "cat: cannot open %s\n", argv[i]);
       exit();
     }
-    cat(fd);
-    close(fd);
+    cat(f);
+    fclose(f);
   }
+  fflush(out);
   exit();
 }
@@ -132,6 +132,7 @@ void panic(char *s) {
   for (i = 0; i < 10; i++)
     cprintf(" %p", pcs[i]);
   panicked = 1; // freeze other CPU
+  uartflush(); // interrupts are off for good; drain the serial ring
   for (;;)
     ;
 }
@@ -141,14 +142,20 @@ void panic(char *s) {
 #define CRTPORT 0x3d4
 static ushort *crt = (ushort *)P2V(0xb8000); // CGA memory
 
-static void cgaputc(int c) {
-  int pos;
+// Cursor position, col + 80*row, cached so output paths don't pay
+// four slow port reads per character.  Synced from the hardware once
+// in consoleinit() and written back by cgaflush().
+static int crtpos;
 
-  // Cursor position: col + 80*row.
+static void cgaflush(void) {
   outb(CRTPORT, 14);
-  pos = inb(CRTPORT + 1) << 8;
+  outb(CRTPORT + 1, crtpos >> 8);
   outb(CRTPORT, 15);
-  pos |= inb(CRTPORT + 1);
+  outb(CRTPORT + 1, crtpos);
+}
+
+static void cgaputc(int c) {
+  int pos = crtpos;
 
   if (c == '\n')
     pos += 80 - pos % 80;
@@ -167,11 +174,48 @@ static void cgaputc(int c) {
     memset(crt + pos, 0, sizeof(crt[0]) * (24 * 80 - pos));
   }
 
-  outb(CRTPORT, 14);
-  outb(CRTPORT + 1, pos >> 8);
-  outb(CRTPORT, 15);
-  outb(CRTPORT + 1, pos);
+  crtpos = pos;
   crt[pos] = ' ' | 0x0700;
+  cgaflush();
+}
+
+// Render a whole buffer of output with at most one scroll and one
+// cursor update.  The first pass computes where the cursor would land
+// on an infinitely tall screen; everything above the final 24 rows is
+// scrolled (or cleared) away in one move, and the second pass then
+// writes each character straight to its post-scroll cell.
+static void cgaputs(char *buf, int n) {
+  int i, c, pos, fpos, scroll;
+
+  pos = crtpos;
+  fpos = pos;
+  for (i = 0; i < n; i++) {
+    if ((buf[i] & 0xff) == '\n')
+      fpos += 80 - fpos % 80;
+    else
+      fpos++;
+  }
+  scroll = fpos / 80 >= 24 ? fpos / 80 - 23 : 0;
+  if (scroll >= 24) {
+    memset(crt, 0, sizeof(crt[0]) * 24 * 80);
+  } else if (scroll > 0) {
+    memmove(crt, crt + 80 * scroll, sizeof(crt[0]) * (24 - scroll) * 80);
+    memset(crt + (24 - scroll) * 80, 0, sizeof(crt[0]) * scroll * 80);
+  }
+  for (i = 0; i < n; i++) {
+    c = buf[i] & 0xff;
+    if (c == '\n')
+      pos += 80 - pos % 80;
+    else {
+      // Output destined above the final screen has scrolled off; skip it.
+      if (pos - 80 * scroll >= 0)
+        crt[pos - 80 * scroll] = c | 0x0700;
+      pos++;
+    }
+  }
+  crtpos = fpos - 80 * scroll;
+  crt[crtpos] = ' ' | 0x0700;
+  cgaflush();
 }
 
 void consputc(int c) {
@@ -249,6 +293,14 @@ int consoleread(struct inode *ip, char *dst, int n) {
 
   iunlock(ip);
   target = n;
+  // The copy runs under cons.lock; resolve the user buffer's pages
+  // first (and again after every sleep, since a sleeping process's
+  // pages can be swapped out) because repairing a page under the
+  // lock would sleep on disk I/O.
+  if (uprefault(dst, n) < 0) {
+    ilock(ip);
+    return -1;
+  }
   acquire(&cons.lock);
   while (n > 0) {
     while (input.r == input.w) {
@@ -258,6 +310,12 @@ int consoleread(struct inode *ip, char *dst, int n) {
         return -1;
       }
       sleep(&input.r, &cons.lock);
+      release(&cons.lock);
+      if (uprefault(dst, n) < 0) {
+        ilock(ip);
+        return -1;
+      }
+      acquire(&cons.lock);
     }
     c = input.buf[input.r++ % INPUT_BUF];
     if (c == C('D')) { // EOF
@@ -283,9 +341,20 @@ int consolewrite(struct inode *ip, char *buf, int n) {
   int i;
 
   iunlock(ip);
+  // See consoleread: no faults under cons.lock.
+  if (uprefault(buf, n) < 0) {
+    ilock(ip);
+    return -1;
+  }
   acquire(&cons.lock);
+  if (panicked) {
+    cli();
+    for (;;)
+      ;
+  }
   for (i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
+    uartputc(buf[i] & 0xff);
+  cgaputs(buf, n);
   release(&cons.lock);
   ilock(ip);
 
@@ -295,6 +364,12 @@ int consolewrite(struct inode *ip, char *buf, int n) {
 void consoleinit(void) {
   initlock(&cons.lock, "console");
 
+  // Pick up wherever the boot loader left the hardware cursor.
+  outb(CRTPORT, 14);
+  crtpos = inb(CRTPORT + 1) << 8;
+  outb(CRTPORT, 15);
+  crtpos |= inb(CRTPORT + 1);
+
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
   cons.locking = 1;
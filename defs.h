@@ -2,6 +2,9 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iokring;
+struct kcache;
+struct lockstat;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,9 +12,17 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct trapframe;
 
 // bio.c
+void basyncdone(struct buf *);
+void bawaitall(void);
+void bawrite(struct buf *);
+void bdirect(uint, uint, char *, int);
 void binit(void);
+char *bmappage(uint, uint);
+struct buf *bpeek(uint, uint);
+void bprefetch(uint, uint);
 struct buf *bread(uint, uint);
 void brelse(struct buf *);
 void bwrite(struct buf *);
@@ -24,13 +35,18 @@ void consoleintr(int (*)(void));
 void panic(char *) __attribute__((noreturn));
 
 // exec.c
+struct execimg;
 int exec(char *, char **);
+int execfault(struct proc *, uint);
+int loadimage(char *, char **, struct execimg *);
 
 // file.c
 struct file *filealloc(void);
 void fileclose(struct file *);
 struct file *filedup(struct file *);
 void fileinit(void);
+int filepread(struct file *, char *, int n, uint off);
+int filepwrite(struct file *, char *, int n, uint off);
 int fileread(struct file *, char *, int n);
 int filestat(struct file *, struct stat *);
 int filewrite(struct file *, char *, int n);
@@ -39,10 +55,16 @@ int filewrite(struct file *, char *, int n);
 void readsb(int dev, struct superblock *sb);
 int dirlink(struct inode *, char *, uint);
 struct inode *dirlookup(struct inode *, char *, uint *);
-struct inode *ialloc(uint, short);
+void dirstat(uint, uint, short *, uint *);
+void dirunlink(struct inode *, char *, uint);
+int dreadi(struct inode *, char *, uint, uint);
+int dwritei(struct inode *, char *, uint, uint);
+void freemapinit(int dev);
+struct inode *ialloc(uint, short, uint);
 struct inode *idup(struct inode *);
 void iinit(int dev);
 void ilock(struct inode *);
+void iprefetch(struct inode *, uint, uint);
 void iput(struct inode *);
 void iunlock(struct inode *);
 void iunlockput(struct inode *);
@@ -51,24 +73,43 @@ int namecmp(const char *, const char *);
 struct inode *namei(char *);
 struct inode *nameiparent(char *, char *);
 int readi(struct inode *, char *, uint, uint);
+char *readpage(struct inode *, uint);
 void stati(struct inode *, struct stat *);
 int writei(struct inode *, char *, uint, uint);
 
 // ide.c
 void ideinit(void);
 void ideintr(void);
+void ideintr2(void);
 void iderw(struct buf *);
 
 // ioapic.c
 void ioapicenable(int irq, int cpu);
 extern uchar ioapicid;
 void ioapicinit(void);
+void ioapicroute(int irq, int cpu);
+
+// ioring.c
+void iodestroy(struct proc *);
+int ioenter(int);
+void iofaultlock(struct proc *);
+void iofaultunlock(struct proc *);
+void ioinit(void);
+int iosetup(void);
 
 // kalloc.c
 char *kalloc(void);
+char *kalloc_pages(int);
+char *kalloczero(void);
 void kfree(char *);
+void kfree_pages(char *, int);
+void kzerodinit(void);
 void kinit1(void *, void *);
 void kinit2(void *, void *);
+void kpresscheck(void);
+void krefinc(char *);
+int krefcount(char *);
+int memwait(void);
 
 // kbd.c
 void kbdintr(void);
@@ -79,6 +120,8 @@ int lapicid(void);
 extern volatile uint *lapic;
 void lapiceoi(void);
 void lapicinit(void);
+void lapicipi(uchar, int);
+void lapicsettick(int);
 void lapicstartap(uchar, uint);
 void microdelay(int);
 
@@ -99,9 +142,15 @@ void picinit(void);
 // pipe.c
 int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
+void pipeinit(void);
 int piperead(struct pipe *, char *, int);
+int pipesplice(struct pipe *, struct file *, int);
 int pipewrite(struct pipe *, char *, int);
 
+// profile.c
+void profinit(void);
+void profsample(struct trapframe *);
+
 // PAGEBREAK: 16
 // proc.c
 int cpuid(void);
@@ -109,31 +158,62 @@ void exit(void);
 int fork(void);
 int growproc(int);
 int kill(int);
+struct proc *kthread(void (*)(void), char *);
 struct cpu *mycpu(void);
 struct proc *myproc();
 void pinit(void);
 void procdump(void);
+int rqempty(void);
 void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void setproc(struct proc *);
+int setpriority(int, int);
 void sleep(void *, struct spinlock *);
+int spawn(char *, char **);
+void swapdone(struct proc *);
+struct proc *swapvictim(void);
 void userinit(void);
 int wait(void);
 void wakeup(void *);
 void yield(void);
 
+// swap.c
+int swapalloc(void);
+void swapfree(int);
+void swapinit(int dev);
+int swapout(void);
+void swapread(int, char *);
+void swapwrite(int, char *);
+
 // swtch.S
 void swtch(struct context **, struct context *);
 
+// trapasm.S
+void sysentry(void);
+
 // spinlock.c
 void acquire(struct spinlock *);
 void getcallerpcs(void *, uint *);
 int holding(struct spinlock *);
 void initlock(struct spinlock *, char *);
+int lockstats(struct lockstat *, int);
 void release(struct spinlock *);
 void pushcli(void);
 void popcli(void);
 
+// shm.c
+void *shmat(int);
+void shmexit(struct proc *);
+int shmfork(struct proc *, struct proc *);
+int shmget(int, int);
+void shminit(void);
+
+// slab.c
+void *kcachealloc(struct kcache *);
+void kcachefree(struct kcache *, void *);
+struct kcache *kcachemk(char *, int);
+void slabinit(void);
+
 // sleeplock.c
 void acquiresleep(struct sleeplock *);
 void releasesleep(struct sleeplock *);
@@ -149,24 +229,50 @@ int strlen(const char *);
 int strncmp(const char *, const char *, uint);
 char *strncpy(char *, const char *, int);
 
+// sysfile.c
+void mmapinit(void);
+int mmapfault(struct proc *, uint);
+char *mpageget(uint, uint, uint);
+char *mpageput(uint, uint, uint, char *);
+
 // syscall.c
 int argint(int, int *);
+void futexinit(void);
 int argptr(int, char **, int);
 int argstr(int, char **);
 int fetchint(uint, int *);
 int fetchstr(uint, char **);
 void syscall(void);
+int uaddrok(uint, uint);
 
 // timer.c
 void timerinit(void);
 
+// tmpfs.c
+uint tmpfsialloc(short);
+void tmpfsifree(uint);
+void tmpfsinit(void);
+void tmpfsiread(struct inode *);
+void tmpfsitrunc(struct inode *);
+void tmpfsiupdate(struct inode *);
+char *tmpfspage(struct inode *, uint);
+void tmpfsread(struct inode *, char *, uint, uint);
+void tmpfsstat(uint, short *, uint *);
+int tmpfswrite(struct inode *, char *, uint, uint);
+
 // trap.c
+void fpuinit(void);
 void idtinit(void);
-extern uint ticks;
+extern volatile uint ticks;
+void *tickchan(uint);
+uint tickcycles(void);
 void tvinit(void);
 extern struct spinlock tickslock;
+int uprefault(char *, uint);
+int uvarepair(struct proc *, uint);
 
 // uart.c
+void uartflush(void);
 void uartinit(void);
 void uartintr(void);
 void uartputc(int);
@@ -176,6 +282,7 @@ void seginit(void);
 void kvmalloc(void);
 pde_t *setupkvm(void);
 char *uva2ka(pde_t *, char *);
+int uvamapped(pde_t *, uint);
 int allocuvm(pde_t *, uint, uint);
 int deallocuvm(pde_t *, uint, uint);
 void freevm(pde_t *);
@@ -186,6 +293,12 @@ void switchuvm(struct proc *);
 void switchkvm(void);
 int copyout(pde_t *, uint, void *, uint);
 void clearpteu(pde_t *pgdir, char *uva);
+int mappages(pde_t *, void *, uint, uint, int);
+int cowfault(pde_t *, uint);
+int lazyfault(pde_t *, uint);
+int pgdirinuse(pde_t *);
+int swapfault(pde_t *, uint);
+int swapoutproc(struct proc *, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
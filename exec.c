@@ -6,16 +6,24 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
 
-int exec(char *path, char **argv) {
+// Build a fresh address space from the ELF executable at path, with
+// argv pushed onto its user stack.  Fills img; on success the caller
+// owns img->pgdir and the img->exeip demand-paging reference and must
+// commit them to a process or free them.  Returns 0 or -1.
+int loadimage(char *path, char **argv, struct execimg *img) {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3 + MAXARG + 1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exeip = 0;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  struct progseg segs[NELFSEG];
+  pde_t *pgdir;
 
   begin_op();
 
@@ -36,8 +44,11 @@ int exec(char *path, char **argv) {
   if ((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Validate the program headers eagerly, but do not load anything:
+  // record the segments and let execfault() read each page in from
+  // the inode on first access.
   sz = 0;
+  nseg = 0;
   for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
     if (readi(ip, (char *)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -47,14 +58,24 @@ int exec(char *path, char **argv) {
       goto bad;
     if (ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if (ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if (ph.vaddr % PGSIZE != 0)
       goto bad;
-    if (loaduvm(pgdir, (char *)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if (nseg >= NELFSEG)
       goto bad;
+    segs[nseg].vaddr = ph.vaddr;
+    segs[nseg].off = ph.off;
+    segs[nseg].filesz = ph.filesz;
+    segs[nseg].memsz = ph.memsz;
+    nseg++;
+    if (ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // Keep a reference to the inode for demand paging, but release the
+  // lock and close the log transaction: page-in only reads.
+  exeip = ip;
+  iunlock(ip);
   end_op();
   ip = 0;
 
@@ -89,16 +110,16 @@ int exec(char *path, char **argv) {
   for (last = s = path; *s; s++)
     if (*s == '/')
       last = s + 1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(img->name, last, sizeof(img->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry; // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  img->pgdir = pgdir;
+  img->sz = sz;
+  img->entry = elf.entry;
+  img->sp = sp;
+  img->exeip = exeip;
+  img->nseg = nseg;
+  for (i = 0; i < nseg; i++)
+    img->segs[i] = segs[i];
   return 0;
 
 bad:
@@ -108,5 +129,160 @@ bad:
     iunlockput(ip);
     end_op();
   }
+  if (exeip) {
+    begin_op();
+    iput(exeip);
+    end_op();
+  }
   return -1;
 }
+
+int exec(char *path, char **argv) {
+  struct execimg img;
+  pde_t *oldpgdir;
+  struct proc *curproc = myproc();
+  int i;
+
+  if (loadimage(path, argv, &img) < 0)
+    return -1;
+  safestrcpy(curproc->name, img.name, sizeof(curproc->name));
+
+  // Commit to the user image.  File mappings do not survive exec.
+  oldpgdir = curproc->pgdir;
+  if (curproc->exeip) {
+    begin_op();
+    iput(curproc->exeip);
+    end_op();
+  }
+  for (i = 0; i < NVMA; i++) {
+    if (curproc->vmas[i].ip) {
+      begin_op();
+      iput(curproc->vmas[i].ip);
+      end_op();
+      curproc->vmas[i].ip = 0;
+    }
+  }
+  shmexit(curproc); // shared memory attachments do not survive either
+  // Nor does the async I/O ring: its queued requests resolve their
+  // buffers against the page table that is about to be freed, and
+  // completions must not land in the new image's memory.
+  iodestroy(curproc);
+  curproc->mmaptop = MMAPTOP;
+  curproc->exeip = img.exeip;
+  curproc->nseg = img.nseg;
+  for (i = 0; i < img.nseg; i++)
+    curproc->segs[i] = img.segs[i];
+  curproc->pgdir = img.pgdir;
+  curproc->sz = img.sz;
+  curproc->tf->eip = img.entry; // main
+  curproc->tf->esp = img.sp;
+  switchuvm(curproc);
+  freevm(oldpgdir);
+  return 0;
+}
+
+// Demand-page one page of p's executable image at va, reading it from
+// the program inode recorded by exec.  Returns 0 on success, -1 if va
+// falls in no program segment or memory is exhausted.
+int execfault(struct proc *p, uint va) {
+  struct progseg *s;
+  char *mem;
+  uint pva, foff, n;
+  int i, locked, clean;
+
+  if (p->exeip == 0 || va >= p->sz)
+    return -1;
+  s = 0;
+  for (i = 0; i < p->nseg; i++) {
+    if (va >= p->segs[i].vaddr && va < p->segs[i].vaddr + p->segs[i].memsz) {
+      s = &p->segs[i];
+      break;
+    }
+  }
+  if (s == 0)
+    return -1;
+
+  pva = PGROUNDDOWN(va);
+  foff = s->off + (pva - s->vaddr);
+
+  // A fully file-backed page is immutable input, so share it instead
+  // of copying: a warm exec of the same binary maps a cached frame
+  // and never touches the disk.  The mapping is copy-on-write, so the
+  // first store to a shared data page gets a private copy while text
+  // stays shared.  Pages with any zero-fill tail (bss, and the last
+  // partial page of a segment) differ from the raw file contents and
+  // stay private.
+  clean = pva + PGSIZE <= s->vaddr + s->filesz;
+
+  // When the segment's file offset is page-aligned the page is
+  // exactly one 4KB block, and the bcache frame itself is mapped
+  // (zero-copy; see readpage).  Binaries linked with unaligned
+  // offsets go through the offset-keyed page cache in sysfile.c,
+  // which assembles the page from two blocks once and shares it
+  // from then on.
+  if (clean && foff % PGSIZE == 0) {
+    locked = !holdingsleep(&p->exeip->lock);
+    if (locked)
+      ilock(p->exeip);
+    mem = readpage(p->exeip, foff);
+    if (locked)
+      iunlock(p->exeip);
+    if (mem != 0) {
+      if (mappages(p->pgdir, (char *)pva, PGSIZE, V2P(mem), PTE_U | PTE_COW) <
+          0) {
+        kfree(mem);
+        return -1;
+      }
+      return 0;
+    }
+  }
+
+  if (clean && (mem = mpageget(p->exeip->dev, p->exeip->inum, foff)) != 0) {
+    if (mappages(p->pgdir, (char *)pva, PGSIZE, V2P(mem), PTE_U | PTE_COW) <
+        0) {
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if ((mem = kalloczero()) == 0)
+    return -1;
+
+  // Read the file-backed part of the page, if any; memsz beyond
+  // filesz is zero-fill (bss) and needs no I/O at all.
+  if (pva < s->vaddr + s->filesz) {
+    n = s->vaddr + s->filesz - pva;
+    if (n > PGSIZE)
+      n = PGSIZE;
+    // The fault may have been taken while this process already held
+    // the executable's inode lock (reading its own binary).
+    locked = !holdingsleep(&p->exeip->lock);
+    if (locked)
+      ilock(p->exeip);
+    if (readi(p->exeip, mem, foff, n) != n) {
+      if (locked)
+        iunlock(p->exeip);
+      kfree(mem);
+      return -1;
+    }
+    if (locked)
+      iunlock(p->exeip);
+  }
+
+  if (clean) {
+    mem = mpageput(p->exeip->dev, p->exeip->inum, foff, mem);
+    if (mappages(p->pgdir, (char *)pva, PGSIZE, V2P(mem), PTE_U | PTE_COW) <
+        0) {
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (mappages(p->pgdir, (char *)pva, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
@@ -2,3 +2,12 @@
 #define O_WRONLY 0x001
 #define O_RDWR 0x002
 #define O_CREATE 0x200
+#define O_DIRECT 0x400 // stream I/O around the buffer cache
+
+// One segment of a readv()/writev() scatter-gather list.
+struct iovec {
+  void *base;
+  uint len;
+};
+
+#define NIOV 16 // segments per readv/writev call
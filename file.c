@@ -5,60 +5,56 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "x86.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
-struct {
-  struct spinlock lock;
-  struct file file[NFILE];
-} ftable;
 
-void fileinit(void) { initlock(&ftable.lock, "ftable"); }
+// struct file entries come from a slab cache (slab.c): allocation
+// and the final close are per-CPU magazine operations, and the file
+// table grows on demand instead of stopping at a static array size.
+// Reference counts are updated with atomic xadd, so filedup() and
+// non-final fileclose() take no lock at all.
+static struct kcache *filecache;
+
+void fileinit(void) { filecache = kcachemk("file", sizeof(struct file)); }
 
 // Allocate a file structure.
 struct file *filealloc(void) {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for (f = ftable.file; f < ftable.file + NFILE; f++) {
-    if (f->ref == 0) {
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if ((f = (struct file *)kcachealloc(filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
 struct file *filedup(struct file *f) {
-  acquire(&ftable.lock);
-  if (f->ref < 1)
+  if ((int)xadd(&f->ref, 1) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void fileclose(struct file *f) {
   struct file ff;
+  int old;
 
-  acquire(&ftable.lock);
-  if (f->ref < 1)
+  old = xadd(&f->ref, -1);
+  if (old < 1)
     panic("fileclose");
-  if (--f->ref > 0) {
-    release(&ftable.lock);
+  if (old > 1)
     return;
-  }
+
+  // Last reference: nobody else can reach f, so it can go back to
+  // the cache before the pipe or inode reference is released.
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
-  release(&ftable.lock);
+  kcachefree(filecache, f);
 
   if (ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -90,7 +86,8 @@ int fileread(struct file *f, char *addr, int n) {
     return piperead(f->pipe, addr, n);
   if (f->type == FD_INODE) {
     ilock(f->ip);
-    if ((r = readi(f->ip, addr, f->off, n)) > 0)
+    if ((r = f->direct ? dreadi(f->ip, addr, f->off, n)
+                       : readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
     return r;
@@ -98,6 +95,50 @@ int fileread(struct file *f, char *addr, int n) {
   panic("fileread");
 }
 
+// Read from file f at the given offset, leaving f->off alone, so
+// readers at independent positions need not serialize on one file.
+// Only inode files have positions.
+int filepread(struct file *f, char *addr, int n, uint off) {
+  int r;
+
+  if (f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = f->direct ? dreadi(f->ip, addr, off, n) : readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Write to file f at the given offset, leaving f->off alone.
+int filepwrite(struct file *f, char *addr, int n, uint off) {
+  int r;
+
+  if (f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  // Write a few blocks at a time; see filewrite for the math.
+  int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+  int i = 0;
+  while (i < n) {
+    int n1 = n - i;
+    if (n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(f->ip);
+    r = f->direct ? dwritei(f->ip, addr + i, off + i, n1)
+                  : writei(f->ip, addr + i, off + i, n1);
+    iunlock(f->ip);
+    end_op();
+
+    if (r < 0)
+      break;
+    if (r != n1)
+      panic("short filepwrite");
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // PAGEBREAK!
 // Write to file f.
 int filewrite(struct file *f, char *addr, int n) {
@@ -114,7 +155,7 @@ int filewrite(struct file *f, char *addr, int n) {
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
+    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
     int i = 0;
     while (i < n) {
       int n1 = n - i;
@@ -123,7 +164,8 @@ int filewrite(struct file *f, char *addr, int n) {
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      if ((r = f->direct ? dwritei(f->ip, addr + i, f->off, n1)
+                         : writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
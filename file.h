@@ -1,8 +1,9 @@
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
-  int ref; // reference count
+  uint ref; // reference count, updated with atomic xadd
   char readable;
   char writable;
+  char direct; // O_DIRECT: bypass the buffer cache (dreadi/dwritei)
   struct pipe *pipe;
   struct inode *ip;
   uint off;
@@ -13,15 +14,20 @@ struct inode {
   uint dev;              // Device number
   uint inum;             // Inode number
   int ref;               // Reference count
+  struct inode *next;    // icache hash bucket chain
   struct sleeplock lock; // protects everything below here
   int valid;             // inode has been read from disk?
+  uint ranext;           // readahead: end offset of the last readi
+  uint agoal;            // preferred block region for balloc (hint only)
+  struct diridx *didx;   // directory index page (T_DIR only), or 0
+  uint *bmapc;           // block-map cache page (see bmap), or 0
 
   short type; // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT + 1];
+  uint addrs[NDIRECT + 2];
 };
 
 // table mapping major device number to
@@ -34,3 +40,5 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define PROFILE 2
+#define PROCSTAT 3
@@ -20,9 +20,16 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "fsstat.h"
+
+// Cache and log counters; bio.c and log.c bump their fields too.
+struct fsstat fsstat;
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode *);
+static void bmapcfree(struct inode *);
+static void dcacheinit(void);
+static void didxfree(struct inode *);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb;
@@ -48,27 +55,99 @@ static void bzero(int dev, int bno) {
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint balloc(uint dev) {
-  int b, bi, m;
+// In-memory copy of the block-allocation bitmap, so balloc() doesn't
+// re-read bitmap blocks from disk and rescan them from block 0 on
+// every allocation.  A set bit means the block is allocated - or
+// reserved by a balloc() whose log write is still in flight; on-disk
+// bitmap updates go through the log exactly as before.  The rotating
+// hint makes appends keep walking forward instead of re-probing the
+// same low, long-allocated blocks.
+static struct {
+  struct spinlock lock;
+  uchar *map; // one bit per block, in a kalloc'd page
+  uint hint;  // next block number to try
+} freemap;
+
+// The same idea for inodes: one bit per inum, set when the on-disk
+// dinode is in use (or claimed by an ialloc() in flight), so create()
+// doesn't bread and scan inode blocks from inum 1 on every call.
+static struct {
+  struct spinlock lock;
+  uchar *map; // one bit per inode, in a kalloc'd page
+  uint hint;  // next inum to try
+} ifree;
+
+// Build the cache from the on-disk bitmap.  Called from forkret()
+// after initlog(), so the bits read here already reflect any
+// transactions replayed by log recovery.
+void freemapinit(int dev) {
   struct buf *bp;
-
-  bp = 0;
+  uint b;
+
+  initlock(&freemap.lock, "freemap");
+  if (sb.size > PGSIZE * 8)
+    panic("freemapinit: fs too large");
+  if ((freemap.map = (uchar *)kalloc()) == 0)
+    panic("freemapinit");
+  memset(freemap.map, 0, PGSIZE);
   for (b = 0; b < sb.size; b += BPB) {
     bp = bread(dev, BBLOCK(b, sb));
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-      m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0) { // Is block free?
-        bp->data[bi / 8] |= m;           // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
-    }
+    memmove(freemap.map + b / 8, bp->data, (min(BPB, sb.size - b) + 7) / 8);
     brelse(bp);
   }
+
+  initlock(&ifree.lock, "ifree");
+  if (sb.ninodes > PGSIZE * 8)
+    panic("freemapinit: too many inodes");
+  if ((ifree.map = (uchar *)kalloc()) == 0)
+    panic("freemapinit");
+  memset(ifree.map, 0, PGSIZE);
+  for (b = 1; b < sb.ninodes; b++) {
+    bp = bread(dev, IBLOCK(b, sb));
+    if (((struct dinode *)bp->data + b % IPB)->type != 0)
+      ifree.map[b / 8] |= 1 << (b % 8);
+    brelse(bp);
+  }
+  ifree.hint = 1;
+}
+
+// Allocate a zeroed disk block, preferring the first free block at or
+// after goal so that a file's blocks - and the files of one directory
+// - end up adjacent on disk.  goal 0 means no preference; those
+// allocations rotate through the global hint instead.
+static uint balloc(uint dev, uint goal) {
+  uint b, i, start;
+  int m;
+  struct buf *bp;
+
+  acquire(&freemap.lock);
+  start = goal < sb.size ? goal : 0;
+  if (start == 0)
+    start = freemap.hint;
+  for (i = 0; i < sb.size; i++) {
+    b = (start + i) % sb.size;
+    m = 1 << (b % 8);
+    if ((freemap.map[b / 8] & m) == 0) {
+      freemap.map[b / 8] |= m;
+      if (goal == 0)
+        freemap.hint = b + 1;
+      release(&freemap.lock);
+      goto found;
+    }
+  }
+  release(&freemap.lock);
   panic("balloc: out of blocks");
+
+found:
+  // Write the bit through to the on-disk bitmap via the log.
+  bp = bread(dev, BBLOCK(b, sb));
+  if (bp->data[b % BPB / 8] & m)
+    panic("balloc: bit set");
+  bp->data[b % BPB / 8] |= m;
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -84,6 +163,10 @@ static void bfree(int dev, uint b) {
   bp->data[bi / 8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&freemap.lock);
+  freemap.map[b / 8] &= ~m;
+  release(&freemap.lock);
 }
 
 // Inodes.
@@ -146,26 +229,50 @@ static void bfree(int dev, uint b) {
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache is a hash table keyed on (dev, inum) with a lock per
+// bucket, so independent path lookups do not serialize.  A bucket's
+// lock protects ip->ref (and the bucket chain); since ip->dev and
+// ip->inum are stable while an entry is in a bucket, they may be read
+// under the same lock.  A global eviction lock serializes only the
+// miss path that recycles entries between buckets, exactly as in the
+// buffer cache.  Entries with ref==0 stay in their bucket and remain
+// valid until recycled.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 13
+#define IHASH(dev, inum) (((dev) ^ (inum)) % NIBUCKET)
+
 struct {
-  struct spinlock lock;
   struct inode inode[NINODE];
+
+  // Serializes recycling of entries between buckets, so an inode is
+  // never cached twice and at most one bucket lock is held at a time.
+  struct spinlock evictlock;
+
+  // Hash buckets, chained through inode->next.
+  struct {
+    struct spinlock lock;
+    struct inode *head;
+  } bucket[NIBUCKET];
 } icache;
 
 void iinit(int dev) {
-  int i = 0;
-
-  initlock(&icache.lock, "icache");
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  struct inode *ip;
+  int i;
+
+  initlock(&icache.evictlock, "icache");
+  dcacheinit();
+  for (i = 0; i < NIBUCKET; i++)
+    initlock(&icache.bucket[i].lock, "icache.bucket");
+
+  // Place all entries in bucket 0; they migrate on first use.
+  for (ip = icache.inode; ip < icache.inode + NINODE; ip++) {
+    initsleeplock(&ip->lock, "inode");
+    ip->next = icache.bucket[0].head;
+    icache.bucket[0].head = ip;
   }
 
   readsb(dev, &sb);
@@ -181,24 +288,43 @@ static struct inode *iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
-struct inode *ialloc(uint dev, short type) {
-  int inum;
+// near names the inum to start searching from - the parent directory,
+// so that related inodes land in the same inode-table blocks; 0 means
+// no preference.
+struct inode *ialloc(uint dev, short type, uint near) {
+  uint inum, i, start;
   struct buf *bp;
   struct dinode *dip;
 
-  for (inum = 1; inum < sb.ninodes; inum++) {
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode *)bp->data + inum % IPB;
-    if (dip->type == 0) { // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp); // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  if (dev == TMPDEV)
+    return iget(dev, tmpfsialloc(type));
+
+  // Claim a free inum in the cached bitmap; only then touch the disk.
+  acquire(&ifree.lock);
+  start = near > 0 && near < sb.ninodes ? near : ifree.hint;
+  for (i = 0; i < sb.ninodes - 1; i++) {
+    inum = (start - 1 + i) % (sb.ninodes - 1) + 1;
+    if ((ifree.map[inum / 8] & (1 << (inum % 8))) == 0) {
+      ifree.map[inum / 8] |= 1 << (inum % 8);
+      if (near == 0)
+        ifree.hint = inum % (sb.ninodes - 1) + 1;
+      release(&ifree.lock);
+      goto found;
     }
-    brelse(bp);
   }
+  release(&ifree.lock);
   panic("ialloc: no inodes");
+
+found:
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode *)bp->data + inum % IPB;
+  if (dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp); // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -209,6 +335,11 @@ void iupdate(struct inode *ip) {
   struct buf *bp;
   struct dinode *dip;
 
+  if (ip->dev == TMPDEV) {
+    tmpfsiupdate(ip);
+    return;
+  }
+
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode *)bp->data + ip->inum % IPB;
   dip->type = ip->type;
@@ -221,46 +352,115 @@ void iupdate(struct inode *ip) {
   brelse(bp);
 }
 
+// Unlink ip from its current hash bucket.
+// Caller must hold that bucket's lock.
+static void iunlink(struct inode *ip) {
+  struct inode **pp;
+
+  for (pp = &icache.bucket[IHASH(ip->dev, ip->inum)].head; *pp;
+       pp = &(*pp)->next) {
+    if (*pp == ip) {
+      *pp = ip->next;
+      return;
+    }
+  }
+  panic("iunlink");
+}
+
+// Search one bucket for (dev, inum).
+// Caller must hold the bucket's lock.
+static struct inode *ifind(int h, uint dev, uint inum) {
+  struct inode *ip;
+
+  for (ip = icache.bucket[h].head; ip; ip = ip->next)
+    if (ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode *iget(uint dev, uint inum) {
   struct inode *ip, *empty;
+  int h, i;
 
-  acquire(&icache.lock);
+  h = IHASH(dev, inum);
 
   // Is the inode already cached?
-  empty = 0;
-  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
+  acquire(&icache.bucket[h].lock);
+  if ((ip = ifind(h, dev, inum)) != 0) {
+    ip->ref++;
+    fsstat.ihit++;
+    release(&icache.bucket[h].lock);
+    return ip;
+  }
+  release(&icache.bucket[h].lock);
+
+  // Not cached; recycle an unreferenced entry.  The eviction lock
+  // serializes this path, so once we re-check the bucket nobody else
+  // can insert the same inode behind our back.
+  acquire(&icache.evictlock);
+  acquire(&icache.bucket[h].lock);
+  if ((ip = ifind(h, dev, inum)) != 0) {
+    ip->ref++;
+    fsstat.ihit++;
+    release(&icache.bucket[h].lock);
+    release(&icache.evictlock);
+    return ip;
+  }
+  release(&icache.bucket[h].lock);
+
+  fsstat.imiss++;
+  // The scan runs without the bucket locks, so a hit in the fast path
+  // above can revive a candidate's ref 0->1 after we pick it; re-check
+  // under its bucket lock and rescan if we lost that race.
+  for (;;) {
+    empty = 0;
+    for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
+      if (ip->ref == 0) {
+        empty = ip;
+        break;
+      }
     }
-    if (empty == 0 && ip->ref == 0) // Remember empty slot.
-      empty = ip;
+    if (empty == 0)
+      panic("iget: no inodes");
+    i = IHASH(empty->dev, empty->inum);
+    acquire(&icache.bucket[i].lock);
+    if (empty->ref == 0)
+      break;
+    release(&icache.bucket[i].lock);
   }
 
-  // Recycle an inode cache entry.
-  if (empty == 0)
-    panic("iget: no inodes");
-
   ip = empty;
+  iunlink(ip);
+  release(&icache.bucket[i].lock);
+
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
-
+  ip->ranext = 0;
+  ip->agoal = 0;
+  didxfree(ip); // slot may carry an index from its previous life
+  bmapcfree(ip); // ...or a block-map cache
+
+  acquire(&icache.bucket[h].lock);
+  ip->next = icache.bucket[h].head;
+  icache.bucket[h].head = ip;
+  release(&icache.bucket[h].lock);
+  release(&icache.evictlock);
   return ip;
 }
 
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode *idup(struct inode *ip) {
-  acquire(&icache.lock);
+  int h = IHASH(ip->dev, ip->inum);
+
+  acquire(&icache.bucket[h].lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&icache.bucket[h].lock);
   return ip;
 }
 
@@ -276,18 +476,25 @@ void ilock(struct inode *ip) {
   acquiresleep(&ip->lock);
 
   if (ip->valid == 0) {
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode *)bp->data + ip->inum % IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    if (ip->dev == TMPDEV) {
+      tmpfsiread(ip);
+    } else {
+      bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+      dip = (struct dinode *)bp->data + ip->inum % IPB;
+      ip->type = dip->type;
+      ip->major = dip->major;
+      ip->minor = dip->minor;
+      ip->nlink = dip->nlink;
+      ip->size = dip->size;
+      memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+      brelse(bp);
+    }
     ip->valid = 1;
     if (ip->type == 0)
       panic("ilock: no type");
+    // Future allocations for this file should stay near its data.
+    if (ip->agoal == 0)
+      ip->agoal = ip->addrs[0];
   }
 }
 
@@ -307,24 +514,33 @@ void iunlock(struct inode *ip) {
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void iput(struct inode *ip) {
+  int h = IHASH(ip->dev, ip->inum);
+
   acquiresleep(&ip->lock);
   if (ip->valid && ip->nlink == 0) {
-    acquire(&icache.lock);
+    acquire(&icache.bucket[h].lock);
     int r = ip->ref;
-    release(&icache.lock);
+    release(&icache.bucket[h].lock);
     if (r == 1) {
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
+      if (ip->dev == TMPDEV) {
+        tmpfsifree(ip->inum);
+      } else {
+        acquire(&ifree.lock);
+        ifree.map[ip->inum / 8] &= ~(1 << (ip->inum % 8));
+        release(&ifree.lock);
+      }
     }
   }
   releasesleep(&ip->lock);
 
-  acquire(&icache.lock);
+  acquire(&icache.bucket[h].lock);
   ip->ref--;
-  release(&icache.lock);
+  release(&icache.bucket[h].lock);
 }
 
 // Common idiom: unlock, then put.
@@ -339,7 +555,8 @@ void iunlockput(struct inode *ip) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT after
+// that in the two-level tree rooted at ip->addrs[NDIRECT+1].
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -348,20 +565,65 @@ static uint bmap(struct inode *ip, uint bn) {
   struct buf *bp;
 
   if (bn < NDIRECT) {
-    if ((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if ((addr = ip->addrs[bn]) == 0) {
+      // Grow right behind the previous block when there is one.
+      uint goal = bn > 0 && ip->addrs[bn - 1] ? ip->addrs[bn - 1] + 1
+                                              : ip->agoal;
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
+      if (ip->agoal == 0)
+        ip->agoal = addr;
+    }
     return addr;
   }
   bn -= NDIRECT;
 
   if (bn < NINDIRECT) {
+    // Per-inode map cache: resolved translations for this range
+    // live in a page hung off the inode (one uint per block; 0
+    // means unresolved), so a sequential scan finds its addresses
+    // here instead of re-reading the indirect block under ip->lock
+    // for every file block.  Entries never go stale — only itrunc()
+    // frees a live file's blocks, and it drops the page.
+    if (ip->bmapc == 0)
+      ip->bmapc = (uint *)kalloczero();
+    if (ip->bmapc && ip->bmapc[bn])
+      return ip->bmapc[bn];
     // Load indirect block, allocating if necessary.
     if ((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->agoal);
     bp = bread(ip->dev, addr);
     a = (uint *)bp->data;
     if ((addr = a[bn]) == 0) {
-      a[bn] = addr = balloc(ip->dev);
+      uint goal = bn > 0 && a[bn - 1] ? a[bn - 1] + 1 : ip->agoal;
+      a[bn] = addr = balloc(ip->dev, goal);
+      log_write(bp);
+    }
+    brelse(bp);
+    if (ip->bmapc)
+      ip->bmapc[bn] = addr;
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if (bn < NDINDIRECT) {
+    // Load doubly-indirect block, then the right indirect block
+    // under it, allocating either if necessary.
+    if ((addr = ip->addrs[NDIRECT + 1]) == 0)
+      ip->addrs[NDIRECT + 1] = addr = balloc(ip->dev, ip->agoal);
+    bp = bread(ip->dev, addr);
+    a = (uint *)bp->data;
+    if ((addr = a[bn / NINDIRECT]) == 0) {
+      a[bn / NINDIRECT] = addr = balloc(ip->dev, ip->agoal);
+      log_write(bp);
+    }
+    brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint *)bp->data;
+    if ((addr = a[bn % NINDIRECT]) == 0) {
+      uint goal = bn % NINDIRECT > 0 && a[bn % NINDIRECT - 1]
+                      ? a[bn % NINDIRECT - 1] + 1
+                      : ip->agoal;
+      a[bn % NINDIRECT] = addr = balloc(ip->dev, goal);
       log_write(bp);
     }
     brelse(bp);
@@ -371,15 +633,32 @@ static uint bmap(struct inode *ip, uint bn) {
   panic("bmap: out of range");
 }
 
+// Drop ip's block-map cache page, if it grew one.
+static void bmapcfree(struct inode *ip) {
+  if (ip->bmapc) {
+    kfree((char *)ip->bmapc);
+    ip->bmapc = 0;
+  }
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
 static void itrunc(struct inode *ip) {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
+
+  if (ip->dev == TMPDEV) {
+    tmpfsitrunc(ip);
+    didxfree(ip);
+    bmapcfree(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for (i = 0; i < NDIRECT; i++) {
     if (ip->addrs[i]) {
@@ -400,6 +679,28 @@ static void itrunc(struct inode *ip) {
     ip->addrs[NDIRECT] = 0;
   }
 
+  if (ip->addrs[NDIRECT + 1]) {
+    bp = bread(ip->dev, ip->addrs[NDIRECT + 1]);
+    a = (uint *)bp->data;
+    for (j = 0; j < NINDIRECT; j++) {
+      if (a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint *)bp2->data;
+      for (k = 0; k < NINDIRECT; k++) {
+        if (a2[k])
+          bfree(ip->dev, a2[k]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT + 1]);
+    ip->addrs[NDIRECT + 1] = 0;
+  }
+
+  didxfree(ip);
+  bmapcfree(ip); // the translations it holds just went stale
   ip->size = 0;
   iupdate(ip);
 }
@@ -432,15 +733,51 @@ int readi(struct inode *ip, char *dst, uint off, uint n) {
   if (off + n > ip->size)
     n = ip->size - off;
 
+  if (ip->dev == TMPDEV) {
+    tmpfsread(ip, dst, off, n);
+    if (myproc())
+      myproc()->rbytes += n;
+    return n;
+  }
+  int seq = (off > 0 && off == ip->ranext);
+
   for (tot = 0; tot < n; tot += m, off += m, dst += m) {
     bp = bread(ip->dev, bmap(ip, off / BSIZE));
     m = min(n - tot, BSIZE - off % BSIZE);
     memmove(dst, bp->data + off % BSIZE, m);
     brelse(bp);
   }
+
+  // If this read continued where the previous one stopped, the file
+  // is being scanned sequentially: stage the next few blocks so the
+  // upcoming reads hit the cache instead of waiting on the disk.
+  // Blocks below ip->size are always allocated, so bmap() here only
+  // looks up addresses; it never grows the file.
+  if (seq && n > 0 && off < ip->size) {
+    uint bn = off / BSIZE, last = (ip->size - 1) / BSIZE;
+    for (m = 0; m < NRABLOCKS && bn + m <= last; m++)
+      bprefetch(ip->dev, bmap(ip, bn + m));
+  }
+  ip->ranext = off;
+  if (myproc())
+    myproc()->rbytes += n;
   return n;
 }
 
+// Zero-copy read of one file block: return the bcache page holding
+// the block at byte offset off (which must be block-aligned) with an
+// extra reference, so the VM can map it into user space instead of
+// copying it.  Returns 0 past EOF.  Caller must hold ip->lock.
+char *readpage(struct inode *ip, uint off) {
+  if (off % BSIZE != 0)
+    panic("readpage");
+  if (off >= ip->size)
+    return 0;
+  if (ip->dev == TMPDEV)
+    return tmpfspage(ip, off);
+  return bmappage(ip->dev, bmap(ip, off / BSIZE));
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -456,7 +793,21 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
 
   if (off > ip->size || off + n < off)
     return -1;
-  if (off + n > MAXFILE * BSIZE)
+
+  if (ip->dev == TMPDEV) {
+    if (tmpfswrite(ip, src, off, n) < 0)
+      return -1;
+    if (n > 0 && off + n > ip->size) {
+      ip->size = off + n;
+      iupdate(ip);
+    }
+    if (myproc())
+      myproc()->wbytes += n;
+    return n;
+  }
+
+  // Compare in blocks: MAXFILE * BSIZE does not fit in 32 bits.
+  if (n > 0 && (off + n - 1) / BSIZE >= MAXFILE)
     return -1;
 
   for (tot = 0; tot < n; tot += m, off += m, src += m) {
@@ -471,6 +822,111 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
     ip->size = off;
     iupdate(ip);
   }
+  if (myproc())
+    myproc()->wbytes += n;
+  return n;
+}
+
+// Stage the blocks covering [off, off+n) into the buffer cache
+// without waiting on any of them, a few per call so one request
+// cannot flush the cache.  Caller must hold ip->lock.  Used by the
+// async I/O worker to get every read of a batch moving on the disk
+// before the first one starts copying.
+void iprefetch(struct inode *ip, uint off, uint n) {
+  uint bn, last, c;
+
+  if (ip->type != T_FILE || ip->dev == TMPDEV || off >= ip->size || n == 0)
+    return;
+  last = min(off + n, ip->size) - 1;
+  c = 0;
+  for (bn = off / BSIZE; bn <= last / BSIZE && c < 2 * NRABLOCKS; bn++, c++)
+    bprefetch(ip->dev, bmap(ip, bn));
+}
+
+// O_DIRECT read: like readi, but blocks that are not already cached
+// are pulled through a private bounce page and never inserted into
+// the buffer cache, so a streaming scan cannot evict hot metadata.
+// Blocks that are cached are copied from the cache, which keeps
+// direct readers coherent with ordinary writers.  Caller must hold
+// ip->lock.
+int dreadi(struct inode *ip, char *dst, uint off, uint n) {
+  uint tot, m, bn;
+  struct buf *bp;
+  char *pg;
+
+  if (ip->type != T_FILE || ip->dev == TMPDEV)
+    return readi(ip, dst, off, n); // nothing to bypass
+  if (off > ip->size || off + n < off)
+    return -1;
+  if (off + n > ip->size)
+    n = ip->size - off;
+  if ((pg = kalloc()) == 0)
+    return -1;
+
+  for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+    bn = bmap(ip, off / BSIZE);
+    m = min(n - tot, BSIZE - off % BSIZE);
+    if ((bp = bpeek(ip->dev, bn)) != 0) {
+      memmove(dst, bp->data + off % BSIZE, m);
+      brelse(bp);
+    } else {
+      bdirect(ip->dev, bn, pg, 0);
+      memmove(dst, pg + off % BSIZE, m);
+    }
+  }
+
+  kfree(pg);
+  if (myproc())
+    myproc()->rbytes += n;
+  return n;
+}
+
+// O_DIRECT write: data for uncached blocks goes straight to the
+// disk through a private bounce page, outside the log — a torn
+// stream after a crash is the price of not flooding the cache.
+// Blocks with a cached copy (including blocks just allocated by
+// bmap, which bzero leaves dirty in the cache) are updated in place
+// through the log as usual, so cached readers never see stale
+// bytes.  Partial uncached blocks are read-modify-written.  Caller
+// must hold ip->lock and be inside a transaction, since extending
+// the file allocates blocks.
+int dwritei(struct inode *ip, char *src, uint off, uint n) {
+  uint tot, m, bn;
+  struct buf *bp;
+  char *pg;
+
+  if (ip->type != T_FILE || ip->dev == TMPDEV)
+    return writei(ip, src, off, n); // nothing to bypass
+  if (off > ip->size || off + n < off)
+    return -1;
+  // Compare in blocks: MAXFILE * BSIZE does not fit in 32 bits.
+  if (n > 0 && (off + n - 1) / BSIZE >= MAXFILE)
+    return -1;
+  if ((pg = kalloc()) == 0)
+    return -1;
+
+  for (tot = 0; tot < n; tot += m, off += m, src += m) {
+    bn = bmap(ip, off / BSIZE);
+    m = min(n - tot, BSIZE - off % BSIZE);
+    if ((bp = bpeek(ip->dev, bn)) != 0) {
+      memmove(bp->data + off % BSIZE, src, m);
+      log_write(bp);
+      brelse(bp);
+    } else {
+      if (m < BSIZE)
+        bdirect(ip->dev, bn, pg, 0);
+      memmove(pg + off % BSIZE, src, m);
+      bdirect(ip->dev, bn, pg, 1);
+    }
+  }
+
+  kfree(pg);
+  if (n > 0 && off > ip->size) {
+    ip->size = off;
+    iupdate(ip);
+  }
+  if (myproc())
+    myproc()->wbytes += n;
   return n;
 }
 
@@ -479,15 +935,200 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
 
 int namecmp(const char *s, const char *t) { return strncmp(s, t, DIRSIZ); }
 
+// In-memory directory index: one page per cached directory inode,
+// built lazily on first lookup and protected by the inode lock.  The
+// hash table maps a name hash to dirent offsets (stored as off+1, so
+// 0 means empty); lookups verify the name against the directory
+// itself, which makes offsets left behind by unlink harmless
+// tombstones.  A small stack of free dirent offsets makes dirlink's
+// free-slot search O(1).
+#define DIDXSLOT 768
+#define DIDXFREE 254
+struct diridx {
+  uint slot[DIDXSLOT];
+  uint nfree;
+  uint freeoff[DIDXFREE];
+};
+
+static uint dhash(const char *name) {
+  uint h = 0;
+  int i;
+
+  for (i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % DIDXSLOT;
+}
+
+// Record (name, off) in the index.  Returns 0 if every probe slot is
+// taken; the caller must then throw the index away.
+static int didxput(struct diridx *dx, const char *name, uint off) {
+  uint h = dhash(name);
+  int i;
+
+  for (i = 0; i < DIDXSLOT; i++) {
+    if (dx->slot[(h + i) % DIDXSLOT] == 0) {
+      dx->slot[(h + i) % DIDXSLOT] = off + 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void didxfree(struct inode *dp) {
+  if (dp->didx) {
+    kfree((char *)dp->didx);
+    dp->didx = 0;
+  }
+}
+
+// Return dp's index, building it with one scan of the directory if
+// it does not exist yet.  Returns 0 (and callers fall back to the
+// linear scan) if no page is available or the directory outgrew the
+// table.
+static struct diridx *didxget(struct inode *dp) {
+  struct diridx *dx;
+  struct dirent de;
+  uint off;
+
+  if (dp->didx)
+    return dp->didx;
+  if ((dx = (struct diridx *)kalloc()) == 0)
+    return 0;
+  memset(dx, 0, PGSIZE);
+
+  for (off = 0; off < dp->size; off += sizeof(de)) {
+    if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+      panic("didxget read");
+    if (de.inum == 0) {
+      if (dx->nfree < DIDXFREE)
+        dx->freeoff[dx->nfree++] = off;
+    } else if (!didxput(dx, de.name, off)) {
+      kfree((char *)dx);
+      return 0;
+    }
+  }
+  dp->didx = dx;
+  return dx;
+}
+
+// Name cache: maps (device, directory inum, name) to the child's
+// inum so namex() can resolve hot path components without locking
+// the directory or reading its blocks.  Direct-mapped; a collision
+// just overwrites the slot.  Entries are invalidated by dirunlink(),
+// which runs before the unlinked inode can be freed — see the
+// re-check in namex() for why that ordering makes hits safe.
+#define NDCENT 256
+struct dcent {
+  uint dev;
+  uint dinum;
+  uint inum; // 0 means empty
+  char name[DIRSIZ];
+};
+static struct {
+  struct spinlock lock;
+  struct dcent ent[NDCENT];
+} dcache;
+
+static void dcacheinit(void) { initlock(&dcache.lock, "dcache"); }
+
+static struct dcent *dcent(struct inode *dp, const char *name) {
+  uint h = dp->inum * 31;
+  int i;
+
+  for (i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.ent[h % NDCENT];
+}
+
+// Look name up in dp's cached entries; 0 on a miss.
+static uint dcacheget(struct inode *dp, const char *name) {
+  struct dcent *e = dcent(dp, name);
+  uint inum = 0;
+
+  acquire(&dcache.lock);
+  if (e->inum && e->dev == dp->dev && e->dinum == dp->inum &&
+      namecmp(name, e->name) == 0)
+    inum = e->inum;
+  release(&dcache.lock);
+  return inum;
+}
+
+static void dcacheput(struct inode *dp, const char *name, uint inum) {
+  struct dcent *e = dcent(dp, name);
+
+  acquire(&dcache.lock);
+  e->dev = dp->dev;
+  e->dinum = dp->inum;
+  e->inum = inum;
+  strncpy(e->name, name, DIRSIZ);
+  release(&dcache.lock);
+}
+
+static void dcachedel(struct inode *dp, const char *name) {
+  struct dcent *e = dcent(dp, name);
+
+  acquire(&dcache.lock);
+  if (e->inum && e->dev == dp->dev && e->dinum == dp->inum &&
+      namecmp(name, e->name) == 0)
+    e->inum = 0;
+  release(&dcache.lock);
+}
+
+// The entry (name, off) was cleared; drop it from the name cache and
+// remember the hole for reuse.  Called with dp locked by the unlink
+// path.
+void dirunlink(struct inode *dp, char *name, uint off) {
+  struct diridx *dx = dp->didx;
+
+  dcachedel(dp, name);
+  if (dx && dx->nfree < DIDXFREE)
+    dx->freeoff[dx->nfree++] = off;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
   uint off, inum;
   struct dirent de;
+  struct diridx *dx;
 
   if (dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // /tmp is the tmpfs mount point; crossing it in either direction
+  // switches devices.  Neither entry exists on disk: "tmp" in the
+  // root directory resolves to the tmpfs root, and ".." out of the
+  // tmpfs root leads back to the disk root.  *poff is set to -1 so
+  // entry-rewriting callers (unlink) can tell there is no dirent.
+  if (dp->dev == ROOTDEV && dp->inum == ROOTINO && namecmp(name, "tmp") == 0) {
+    if (poff)
+      *poff = (uint)-1;
+    return iget(TMPDEV, ROOTINO);
+  }
+  if (dp->dev == TMPDEV && dp->inum == ROOTINO && namecmp(name, "..") == 0) {
+    if (poff)
+      *poff = (uint)-1;
+    return iget(ROOTDEV, ROOTINO);
+  }
+
+  if ((dx = didxget(dp)) != 0) {
+    uint h = dhash(name), s;
+    int i;
+
+    for (i = 0; i < DIDXSLOT; i++) {
+      if ((s = dx->slot[(h + i) % DIDXSLOT]) == 0)
+        return 0; // every cached entry was inserted, so this is a miss
+      if (readi(dp, (char *)&de, s - 1, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if (de.inum != 0 && namecmp(name, de.name) == 0) {
+        if (poff)
+          *poff = s - 1;
+        return iget(dp->dev, de.inum);
+      }
+    }
+    // Probe chain never hit an empty slot; scan the long way.
+  }
+
   for (off = 0; off < dp->size; off += sizeof(de)) {
     if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -507,9 +1148,10 @@ struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
 
 // Write a new directory entry (name, inum) into the directory dp.
 int dirlink(struct inode *dp, char *name, uint inum) {
-  int off;
+  uint off;
   struct dirent de;
   struct inode *ip;
+  struct diridx *dx;
 
   // Check that name is not present.
   if ((ip = dirlookup(dp, name, 0)) != 0) {
@@ -517,22 +1159,51 @@ int dirlink(struct inode *dp, char *name, uint inum) {
     return -1;
   }
 
-  // Look for an empty dirent.
-  for (off = 0; off < dp->size; off += sizeof(de)) {
-    if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if (de.inum == 0)
-      break;
+  // Find an empty dirent: pop a remembered hole, or append; without
+  // an index, scan for one.
+  if ((dx = didxget(dp)) != 0) {
+    off = dx->nfree > 0 ? dx->freeoff[--dx->nfree] : dp->size;
+  } else {
+    for (off = 0; off < dp->size; off += sizeof(de)) {
+      if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if (de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if (writei(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
-
+  if (dx && !didxput(dx, name, off))
+    didxfree(dp); // table full; fall back to scans for this inode
+  dcacheput(dp, name, inum);
   return 0;
 }
 
+// Read type and size of inode (dev, inum) straight from its inode
+// block, with no icache or inode-lock traffic; used by getdents to
+// stat a whole directory batch cheaply.  The caller holds the parent
+// directory's lock, so the entry cannot be unlinked and its inode
+// reused underneath us.  The icache is write-through (see iupdate),
+// so the on-disk copy in the buffer cache is current.
+void dirstat(uint dev, uint inum, short *type, uint *size) {
+  struct buf *bp;
+  struct dinode *dip;
+
+  if (dev == TMPDEV) {
+    tmpfsstat(inum, type, size);
+    return;
+  }
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode *)bp->data + inum % IPB;
+  *type = dip->type;
+  *size = dip->size;
+  brelse(bp);
+}
+
 // PAGEBREAK!
 // Paths
 
@@ -577,6 +1248,7 @@ static char *skipelem(char *path, char *name) {
 // Must be called inside a transaction since it calls iput().
 static struct inode *namex(char *path, int nameiparent, char *name) {
   struct inode *ip, *next;
+  uint inum;
 
   if (*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -584,6 +1256,22 @@ static struct inode *namex(char *path, int nameiparent, char *name) {
     ip = idup(myproc()->cwd);
 
   while ((path = skipelem(path, name)) != 0) {
+    // Fast path: a name-cache hit resolves the component without
+    // locking the directory or reading its blocks.  Re-checking the
+    // entry after iget() closes the race with a concurrent unlink:
+    // dirunlink() drops the entry before the inode can be freed, so
+    // if the entry is still present now, the name still refers to
+    // this inum and our reference pins the inode.
+    if (!(nameiparent && *path == '\0') &&
+        (inum = dcacheget(ip, name)) != 0) {
+      next = iget(ip->dev, inum);
+      if (dcacheget(ip, name) == inum) {
+        iput(ip);
+        ip = next;
+        continue;
+      }
+      iput(next);
+    }
     ilock(ip);
     if (ip->type != T_DIR) {
       iunlockput(ip);
@@ -598,6 +1286,10 @@ static struct inode *namex(char *path, int nameiparent, char *name) {
       iunlockput(ip);
       return 0;
     }
+    // Mount crossings change device; the name cache is keyed by the
+    // parent's device, so caching one would corrupt the fast path.
+    if (next->dev == ip->dev)
+      dcacheput(ip, name, next->inum);
     iunlockput(ip);
     ip = next;
   }
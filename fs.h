@@ -2,7 +2,11 @@
 // Both the kernel and user programs use this header file.
 
 #define ROOTINO 1 // root i-number
-#define BSIZE 512 // block size
+// Block size.  Equal to the page size, so a page of file data is one
+// block: one bread, one cache entry, and one log slot instead of
+// eight, and buffers line up with pages where the VM and FS meet.
+// The IDE driver transfers BSIZE/512 disk sectors per block.
+#define BSIZE 4096
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -18,11 +22,14 @@ struct superblock {
   uint logstart;   // Block number of first log block
   uint inodestart; // Block number of first inode block
   uint bmapstart;  // Block number of first free map block
+  uint swapstart;  // Block number of first swap block (after the fs)
+  uint nswap;      // Number of swap blocks; 0 if the image has none
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -31,7 +38,9 @@ struct dinode {
   short minor;             // Minor device number (T_DEV only)
   short nlink;             // Number of links to inode in file system
   uint size;               // Size of file (bytes)
-  uint addrs[NDIRECT + 1]; // Data block addresses
+  uint addrs[NDIRECT + 2]; // Data block addresses; addrs[NDIRECT] is the
+                           // indirect block, addrs[NDIRECT+1] the
+                           // doubly-indirect block
 };
 
 // Inodes per block.
@@ -49,6 +58,15 @@ struct dinode {
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
+// A getdents() record: one directory entry plus the metadata a
+// listing needs, so callers need not stat() every name.
+struct dent {
+  ushort inum;
+  short type; // T_DIR, T_FILE, T_DEV (stat.h)
+  uint size;
+  char name[DIRSIZ];
+};
+
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
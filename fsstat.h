@@ -0,0 +1,16 @@
+// Filesystem cache and log counters, read via the fsstats() system
+// call.  The counters are copied without locks, so a snapshot may be
+// slightly stale; good enough for sizing NBUF, NINODE, and LOGSIZE
+// from measurement instead of folklore.
+struct fsstat {
+  uint bhit;      // bget: block found in the buffer cache
+  uint bmiss;     // bget: block had to be brought in
+  uint brecycle;  // bget: a buffer with valid data was evicted for it
+  uint ihit;      // iget: inode found in the inode cache
+  uint imiss;     // iget: a cache slot had to be claimed
+  uint logwait;   // begin_op: times a caller slept (log busy or full)
+  uint logcommit; // commits carried out
+  uint logblocks; // log blocks written by those commits
+};
+
+extern struct fsstat fsstat;
@@ -5,14 +5,15 @@
 #include "user.h"
 
 char buf[1024];
+FILE *out;
 int match(char *, char *);
 
-void grep(char *pattern, int fd) {
+void grep(char *pattern, FILE *f) {
   int n, m;
   char *p, *q;
 
   m = 0;
-  while ((n = read(fd, buf + m, sizeof(buf) - m - 1)) > 0) {
+  while ((n = fread(f, buf + m, sizeof(buf) - m - 1)) > 0) {
     m += n;
     buf[m] = '\0';
     p = buf;
@@ -20,7 +21,7 @@ void grep(char *pattern, int fd) {
       *q = 0;
       if (match(pattern, p)) {
         *q = '\n';
-        write(1, p, q + 1 - p);
+        fwrite(out, p, q + 1 - p);
       }
       p = q + 1;
     }
@@ -34,7 +35,8 @@ void grep(char *pattern, int fd) {
 }
 
 int main(int argc, char *argv[]) {
-  int fd, i;
+  FILE *f;
+  int i;
   char *pattern;
 
   if (argc <= 1) {
@@ -43,19 +45,22 @@ int main(int argc, char *argv[]) {
   }
   pattern = argv[1];
 
+  out = fdopen(1, "w");
   if (argc <= 2) {
-    grep(pattern, 0);
+    grep(pattern, fdopen(0, "r"));
+    fflush(out);
     exit();
   }
 
   for (i = 2; i < argc; i++) {
-    if ((fd = open(argv[i], 0)) < 0) {
+    if ((f = fopen(argv[i], "r")) == 0) {
       printf(1, "grep: cannot open %s\n", argv[i]);
       exit();
     }
-    grep(pattern, fd);
-    close(fd);
+    grep(pattern, f);
+    fclose(f);
   }
+  fflush(out);
   exit();
 }
 
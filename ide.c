@@ -1,4 +1,18 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver.  Uses busmaster (PIIX-style) DMA with multi-sector
+// transfers when the PCI IDE controller advertises it, falling back
+// to single-sector PIO otherwise.
+//
+// When a disk is present on the secondary channel the filesystem
+// device is striped across the primary slave and the secondary
+// master, block-interleaved: even blocks live on the primary fs disk,
+// odd blocks on the secondary disk, each at physical block number
+// blockno/2.  The two channels have independent command and busmaster
+// registers, so a sequential run splits into two transfers that
+// proceed in parallel, roughly doubling bandwidth.  (Striping across
+// the two drives of the primary channel would buy nothing - they
+// share one cable and one command slot - and disk 0 holds the boot
+// image.)  Without a secondary disk everything goes to the primary
+// channel as before.
 
 #include "types.h"
 #include "defs.h"
@@ -23,104 +37,337 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDMA 0xc8
+#define IDE_CMD_WDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Busmaster register offsets (per channel) and bits.
+#define BM_CMD 0
+#define BM_STAT 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08 // transfer direction: device to memory
+#define BM_STAT_ERR 0x02
+#define BM_STAT_IRQ 0x04
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+// Physical region descriptor: one scatter-gather entry of a DMA
+// transfer.  An entry must not cross a 64KB physical boundary.
+struct prd {
+  uint addr;
+  ushort nbytes;
+  ushort flags;
+};
+#define PRD_EOT 0x8000 // last entry of the table
+
+#define MAXRUN 16            // max blocks folded into one transfer
+#define NPRD (2 * MAXRUN)    // each buffer may split at a 64KB boundary
+
+// One ATA channel.  queue points to the buf now being read/written to
+// the disk; queue->qnext points to the next buf to be processed.  You
+// must hold lock while manipulating the queue.
+struct idechan {
+  struct spinlock lock;
+  struct buf *queue;
+  int nrun;       // queued bufs covered by the active request
+  ushort iobase;  // command block registers
+  ushort ctlbase; // device control register
+  ushort bm;      // busmaster registers; 0 means PIO fallback
+  struct prd prdt[NPRD] __attribute__((aligned(256)));
+};
+
+static struct idechan idec[2] = {
+    {.iobase = 0x1f0, .ctlbase = 0x3f6},
+    {.iobase = 0x170, .ctlbase = 0x376},
+};
+
+static ushort bmbase; // primary channel busmaster I/O base
 
 static int havedisk1;
-static void idestart(struct buf *);
+static int havedisk2; // secondary master: enables striping
+static void idestart(struct idechan *);
+
+// Is this request striped across both channels?
+static int striped(struct buf *b) {
+  return havedisk2 && b->dev == ROOTDEV;
+}
+
+// The channel serving b, and b's block number on that channel's disk.
+static struct idechan *blockchan(struct buf *b, uint *diskbno) {
+  if (striped(b)) {
+    *diskbno = b->blockno >> 1;
+    return &idec[b->blockno & 1];
+  }
+  *diskbno = b->blockno;
+  return &idec[0];
+}
 
-// Wait for IDE disk to become ready.
-static int idewait(int checkerr) {
+// Drive select bits for b on channel c.  The secondary disk is the
+// channel master; on the primary channel the device number picks
+// between boot disk and fs disk as before.
+static int drivesel(struct idechan *c, struct buf *b) {
+  return c == &idec[0] ? (b->dev & 1) << 4 : 0;
+}
+
+// PCI configuration space access, used only to find the IDE
+// controller's busmaster registers.
+static uint pciread(int dev, int fn, int off) {
+  outdw(0xcf8, 0x80000000 | (dev << 11) | (fn << 8) | (off & 0xfc));
+  return indw(0xcfc);
+}
+
+static void pciwrite(int dev, int fn, int off, uint val) {
+  outdw(0xcf8, 0x80000000 | (dev << 11) | (fn << 8) | (off & 0xfc));
+  outdw(0xcfc, val);
+}
+
+// Scan PCI bus 0 for an IDE controller with a busmaster BAR and
+// enable bus mastering on it.
+static void idedmainit(void) {
+  int dev, fn;
+  uint id, class, bar4;
+
+  for (dev = 0; dev < 32; dev++) {
+    for (fn = 0; fn < 8; fn++) {
+      id = pciread(dev, fn, 0);
+      if ((id & 0xffff) == 0xffff)
+        continue;
+      class = pciread(dev, fn, 8);
+      if ((class >> 16) != 0x0101) // class 1 (storage), subclass 1 (IDE)
+        continue;
+      bar4 = pciread(dev, fn, 0x20);
+      if ((bar4 & 1) == 0 || (bar4 & ~0xf) == 0)
+        continue;
+      pciwrite(dev, fn, 4, pciread(dev, fn, 4) | 0x5); // I/O + busmaster
+      bmbase = bar4 & ~0x3;
+      cprintf("ide: busmaster dma at 0x%x\n", bmbase);
+      return;
+    }
+  }
+  cprintf("ide: no busmaster controller, using pio\n");
+}
+
+// Wait for the disk on channel c to become ready.
+static int idewait(struct idechan *c, int checkerr) {
   int r;
 
-  while (((r = inb(0x1f7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY)
+  while (((r = inb(c->iobase + 7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY)
     ;
   if (checkerr && (r & (IDE_DF | IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
-void ideinit(void) {
-  int i;
+// Does a disk answer at drive select dsel on channel c?  A floating
+// bus reads back 0xff from the status register.
+static int ideprobe(struct idechan *c, int dsel) {
+  int i, r;
 
-  initlock(&idelock, "ide");
+  outb(c->iobase + 6, 0xe0 | dsel);
+  for (i = 0; i < 1000; i++) {
+    r = inb(c->iobase + 7);
+    if (r != 0 && r != 0xff)
+      return 1;
+  }
+  return 0;
+}
+
+// Put the drive at drive-select dsel on channel c into multi-sector
+// mode, so the PIO fallback moves one whole fs block (BSIZE/512
+// sectors) per RDMUL/WRMUL command and interrupt.
+static void idesetmult(struct idechan *c, int dsel) {
+  if (BSIZE / SECTOR_SIZE == 1)
+    return;
+  outb(c->iobase + 6, 0xe0 | dsel);
+  idewait(c, 0);
+  outb(c->iobase + 2, BSIZE / SECTOR_SIZE);
+  outb(c->iobase + 7, IDE_CMD_SETMUL);
+  idewait(c, 0);
+}
+
+void ideinit(void) {
+  initlock(&idec[0].lock, "ide");
+  initlock(&idec[1].lock, "ide1");
+  idedmainit();
+  idec[0].bm = bmbase;
+  idec[1].bm = bmbase ? bmbase + 8 : 0;
+  // Steer disk completion work away from CPU 0, which already takes
+  // the timer, keyboard and serial interrupts; with two channels,
+  // each gets its own CPU so completions also don't stack up on one
+  // core.
   ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  idewait(&idec[0], 0);
 
   // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1 << 4));
-  for (i = 0; i < 1000; i++) {
-    if (inb(0x1f7) != 0) {
-      havedisk1 = 1;
-      break;
-    }
-  }
+  havedisk1 = ideprobe(&idec[0], 1 << 4);
+
+  idesetmult(&idec[0], 0);
+  if (havedisk1)
+    idesetmult(&idec[0], 1 << 4);
 
   // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0 << 4));
+  outb(idec[0].iobase + 6, 0xe0);
+
+  // A disk on the secondary channel enables striped mode; both halves
+  // of the filesystem must have been built by mkfs -stripe.
+  havedisk2 = ideprobe(&idec[1], 0);
+  if (havedisk2) {
+    idesetmult(&idec[1], 0);
+    ioapicenable(IRQ_IDE2, ncpu > 1 ? ncpu - 2 : 0);
+    cprintf("ide: striping fs across both channels\n");
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
-static void idestart(struct buf *b) {
+// Start the request for the head of c's queue.  With DMA available,
+// fold immediately following queue entries that target adjacent
+// sectors in the same direction into one multi-sector transfer
+// described by the PRD table.  On a striped channel logically
+// alternating blocks are physically adjacent, so consecutive blocks
+// of a sequential run still merge.  Caller must hold c->lock.
+static void idestart(struct idechan *c) {
+  struct buf *b, *q;
+  uint pa, n, chunk, diskbno;
+  int i, np, dirty, stride;
+
+  b = c->queue;
   if (b == 0)
     panic("idestart");
-  if (b->blockno >= FSSIZE)
+  if (b->blockno >= FSSIZE + NSWAPPAGES * (PGSIZE / BSIZE))
     panic("incorrect blockno");
+  blockchan(b, &diskbno);
+  stride = striped(b) ? 2 : 1;
   int sector_per_block = BSIZE / SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
+  int sector = diskbno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7)
+  // idesetmult() configured this many sectors per PIO command; 16 is
+  // the usual drive maximum.  The DMA path's 8-bit sector-count
+  // register also bounds a merged run: MAXRUN * sector_per_block must
+  // stay <= 256.
+  if (sector_per_block > 16 || MAXRUN * sector_per_block > 256)
     panic("idestart");
 
-  idewait(0);
-  outb(0x3f6, 0);                // generate interrupt
-  outb(0x1f2, sector_per_block); // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
-  if (b->flags & B_DIRTY) {
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE / 4);
+  idewait(c, 0);
+
+  if (c->bm == 0) {
+    // PIO fallback: one block per request and interrupt.
+    c->nrun = 1;
+    outb(c->ctlbase, 0);                   // generate interrupt
+    outb(c->iobase + 2, sector_per_block); // number of sectors
+    outb(c->iobase + 3, sector & 0xff);
+    outb(c->iobase + 4, (sector >> 8) & 0xff);
+    outb(c->iobase + 5, (sector >> 16) & 0xff);
+    outb(c->iobase + 6, 0xe0 | drivesel(c, b) | ((sector >> 24) & 0x0f));
+    if (b->flags & B_DIRTY) {
+      outb(c->iobase + 7, write_cmd);
+      outsl(c->iobase, b->data, BSIZE / 4);
+    } else {
+      outb(c->iobase + 7, read_cmd);
+    }
+    return;
+  }
+
+  // Gather the run of adjacent same-direction requests behind b.
+  dirty = b->flags & B_DIRTY;
+  c->nrun = 1;
+  for (q = b->qnext; q && c->nrun < MAXRUN; q = q->qnext) {
+    if (q->dev != b->dev || (q->flags & B_DIRTY) != dirty ||
+        q->blockno != b->blockno + c->nrun * stride)
+      break;
+    c->nrun++;
+  }
+
+  // Build the PRD table, splitting any buffer that straddles a 64KB
+  // physical boundary as the busmaster spec requires.
+  np = 0;
+  for (i = 0, q = b; i < c->nrun; i++, q = q->qnext) {
+    pa = V2P(q->data);
+    n = BSIZE;
+    while (n > 0) {
+      chunk = 0x10000 - (pa & 0xffff);
+      if (chunk > n)
+        chunk = n;
+      c->prdt[np].addr = pa;
+      c->prdt[np].nbytes = chunk;
+      c->prdt[np].flags = 0;
+      np++;
+      pa += chunk;
+      n -= chunk;
+    }
+  }
+  c->prdt[np - 1].flags = PRD_EOT;
+
+  // Arm the busmaster engine, then issue the DMA command.
+  outb(c->bm + BM_CMD, 0);
+  outdw(c->bm + BM_PRDT, V2P(c->prdt));
+  outb(c->bm + BM_STAT, inb(c->bm + BM_STAT) | BM_STAT_IRQ | BM_STAT_ERR);
+
+  outb(c->ctlbase, 0); // generate interrupt
+  outb(c->iobase + 2, c->nrun * sector_per_block);
+  outb(c->iobase + 3, sector & 0xff);
+  outb(c->iobase + 4, (sector >> 8) & 0xff);
+  outb(c->iobase + 5, (sector >> 16) & 0xff);
+  outb(c->iobase + 6, 0xe0 | drivesel(c, b) | ((sector >> 24) & 0x0f));
+  if (dirty) {
+    outb(c->iobase + 7, IDE_CMD_WDMA);
+    outb(c->bm + BM_CMD, BM_CMD_START);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->iobase + 7, IDE_CMD_RDMA);
+    outb(c->bm + BM_CMD, BM_CMD_START | BM_CMD_READ);
   }
 }
 
-// Interrupt handler.
-void ideintr(void) {
+// Interrupt handler for one channel.
+static void ideintrchan(struct idechan *c) {
   struct buf *b;
+  int i, n;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  // First queued buffers form the active request.
+  acquire(&c->lock);
 
-  if ((b = idequeue) == 0) {
-    release(&idelock);
+  if (c->queue == 0) {
+    release(&c->lock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE / 4);
+  if (c->bm) {
+    // Stop the busmaster engine and ack its interrupt/error bits.
+    outb(c->bm + BM_CMD, 0);
+    outb(c->bm + BM_STAT, inb(c->bm + BM_STAT) | BM_STAT_IRQ | BM_STAT_ERR);
+  }
+
+  // Complete every buffer covered by the transfer.
+  n = c->nrun;
+  for (i = 0; i < n && (b = c->queue) != 0; i++) {
+    c->queue = b->qnext;
+
+    // PIO read: pull the data out of the controller.
+    if (c->bm == 0 && !(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+      insl(c->iobase, b->data, BSIZE / 4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf, or finish a readahead
+    // buffer that nobody is waiting for.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if (b->flags & B_ASYNC)
+      basyncdone(b);
+    else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
-  if (idequeue != 0)
-    idestart(idequeue);
+  if (c->queue != 0)
+    idestart(c);
 
-  release(&idelock);
+  release(&c->lock);
+}
+
+void ideintr(void) {
+  ideintrchan(&idec[0]);
+}
+
+void ideintr2(void) {
+  ideintrchan(&idec[1]);
 }
 
 // PAGEBREAK!
@@ -128,7 +375,9 @@ void ideintr(void) {
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void iderw(struct buf *b) {
+  struct idechan *c;
   struct buf **pp;
+  uint diskbno;
 
   if (!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -137,22 +386,58 @@ void iderw(struct buf *b) {
   if (b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock); // DOC:acquire-lock
+  c = blockchan(b, &diskbno);
+  acquire(&c->lock); // DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Insert b into the queue, which is kept sorted by block number
+  // with a single wrap point (C-LOOK elevator) so the disk sweeps in
+  // one direction and adjacent requests line up for idestart()'s
+  // multi-sector merging.  (On a striped channel logical and physical
+  // block order agree, so sorting by blockno still works.)  The first
+  // nrun entries belong to the transfer already on the wire and must
+  // not be disturbed.
   b->qnext = 0;
-  for (pp = &idequeue; *pp; pp = &(*pp)->qnext) // DOC:insert-queue
-    ;
-  *pp = b;
+  pp = &c->queue;
+  if (*pp) {
+    struct buf *cur, *nxt;
+    int i;
+
+    for (i = 0; i < c->nrun && *pp; i++)
+      pp = &(*pp)->qnext;
+    for (; (cur = *pp) != 0; pp = &cur->qnext) {
+      nxt = cur->qnext;
+      if (nxt == 0)
+        break; // append after the last entry
+      if (cur->blockno <= b->blockno && b->blockno <= nxt->blockno)
+        break; // in-order slot
+      if (cur->blockno > nxt->blockno &&
+          (b->blockno >= cur->blockno || b->blockno <= nxt->blockno))
+        break; // slot at the wrap point
+    }
+    if (cur) {
+      b->qnext = cur->qnext;
+      cur->qnext = b;
+    } else {
+      *pp = b;
+    }
+  } else {
+    *pp = b;
+  }
 
   // Start disk if necessary.
-  if (idequeue == b)
-    idestart(b);
+  if (c->queue == b)
+    idestart(c);
+
+  // Readahead requests complete from the interrupt handler.
+  if (b->flags & B_ASYNC) {
+    release(&c->lock);
+    return;
+  }
 
   // Wait for request to finish.
   while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID) {
-    sleep(b, &idelock);
+    sleep(b, &c->lock);
   }
 
-  release(&idelock);
+  release(&c->lock);
 }
@@ -4,7 +4,10 @@
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "traps.h"
+#include "mmu.h"
+#include "proc.h"
 
 #define IOAPIC 0xFEC00000 // Default physical address of IO APIC
 
@@ -58,10 +61,19 @@ void ioapicinit(void) {
   }
 }
 
+// Steer irq to the given CPU by rewriting its redirection entry's
+// destination field, so interrupt-heavy devices can be kept off
+// CPUs with better things to do.  The table is in physical
+// destination mode, which wants the CPU's APIC ID, not its index.
+void ioapicroute(int irq, int cpunum) {
+  if (cpunum < 0 || cpunum >= ncpu)
+    panic("ioapicroute");
+  ioapicwrite(REG_TABLE + 2 * irq + 1, cpus[cpunum].apicid << 24);
+}
+
 void ioapicenable(int irq, int cpunum) {
   // Mark interrupt edge-triggered, active high,
-  // enabled, and routed to the given cpunum,
-  // which happens to be that cpu's APIC ID.
+  // enabled, and routed to the given cpunum.
   ioapicwrite(REG_TABLE + 2 * irq, T_IRQ0 + irq);
-  ioapicwrite(REG_TABLE + 2 * irq + 1, cpunum << 24);
+  ioapicroute(irq, cpunum);
 }
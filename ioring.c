@@ -0,0 +1,381 @@
+// Asynchronous I/O rings: an io_uring-style submission/completion
+// interface, so one process can keep many disk operations in flight
+// instead of paying one full latency per read() in turn.
+//
+// iosetup() maps a page laid out as struct ioring (ioring.h) into
+// the caller.  ioenter() drains the submission queue in process
+// context — where file descriptors and buffer addresses can be
+// validated — turning each entry into a request holding its own
+// file reference, and hands the batch to a kernel worker thread.
+// The worker first queues the disk blocks every read in the batch
+// will need, so the disk elevator sees the whole batch at once and
+// the drive stays busy across requests; then it moves the bytes
+// with filepread/filepwrite and posts completions.  The ring page
+// sits in the mmap arena like a shared memory segment: fork's COW
+// walk never touches it, and freevm() returns the mapping's page
+// reference at exit.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "ioring.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NIORING 8 // rings; at most one per process
+#define NIOREQ 64 // in-flight requests, all rings together
+
+struct iokring {
+  struct ioring *ring; // kernel address of the shared page
+  uint uva;            // where the page is mapped in the owner
+  struct proc *owner;  // 0 marks a free slot
+  int inflight;        // handed to the worker, completion not posted
+  int dying;           // owner is exiting; leave ring and pgdir alone
+  struct sleeplock pflock; // serializes page repairs: worker vs owner
+};
+
+struct ioreq {
+  struct iokring *r;
+  struct file *f; // holds its own reference; closed by the worker
+  int op;
+  uint addr, len, off, id;
+  struct ioreq *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct iokring ring[NIORING];
+  struct ioreq pool[NIOREQ];
+  struct ioreq *free;
+  struct ioreq *head; // submitted requests, oldest first
+  int busy;           // worker is mid-batch; iodestroy() waits this out
+  int ready;          // worker thread has been started
+} iow;
+
+void ioinit(void) {
+  int i;
+
+  initlock(&iow.lock, "ioring");
+  for (i = 0; i < NIORING; i++)
+    initsleeplock(&iow.ring[i].pflock, "ioring");
+  for (i = 0; i < NIOREQ; i++) {
+    iow.pool[i].next = iow.free;
+    iow.free = &iow.pool[i];
+  }
+}
+
+// Post one completion into r's ring and poke anyone waiting in
+// ioenter().  The CQ cannot overflow: submission stops while the
+// unreaped completions plus requests in flight would not fit.
+// Caller holds iow.lock.
+static void iopost(struct iokring *r, uint id, int res) {
+  struct ioring *ring = r->ring;
+  struct iocqe *c = &ring->cq[ring->cqtail % NCQE];
+
+  c->id = id;
+  c->res = res;
+  ring->cqtail++;
+  wakeup(r);
+}
+
+// Resolve one page of the owner's buffer to a kernel address and pin
+// it.  The worker runs on the kernel page table, so it cannot
+// dereference user pointers directly; uva2ka also repairs
+// swapped-out and copy-on-write pages, and uvarepair() covers the
+// rest (lazy heap, mmap, demand-paged text) the way trap() would.
+// Repairs race the owner faulting on the same page table — both
+// sides would mappages() the same empty PTE and the loser panics on
+// the remap — so they are serialized by the ring's pflock, which the
+// owner's fault path takes via iofaultlock().  The extra reference
+// keeps the frame from being freed or picked as a swap victim while
+// the copy runs outside the lock; the caller drops it with kfree().
+static char *iouserpage(struct iokring *r, uint va) {
+  struct proc *p = r->owner;
+  char *ka;
+
+  acquiresleep(&r->pflock);
+  if ((ka = uva2ka(p->pgdir, (char *)va)) == 0) {
+    if (uvarepair(p, va) < 0 ||
+        (ka = uva2ka(p->pgdir, (char *)va)) == 0) {
+      releasesleep(&r->pflock);
+      return 0;
+    }
+  }
+  krefinc(ka);
+  releasesleep(&r->pflock);
+  return ka;
+}
+
+// The owner's page-fault repairs take the same lock as the worker's
+// (see iouserpage); no-ops for a process with no ring.
+void iofaultlock(struct proc *p) {
+  if (p && p->ioring)
+    acquiresleep(&p->ioring->pflock);
+}
+
+void iofaultunlock(struct proc *p) {
+  if (p && p->ioring)
+    releasesleep(&p->ioring->pflock);
+}
+
+// Stage the disk blocks a read will need, without waiting on any of
+// them.  Issued for the whole batch before any request starts
+// copying, this is what overlaps the batch's disk time.
+static void ioprefetch(struct ioreq *q) {
+  struct inode *ip = q->f->ip;
+
+  if (q->op != IORING_READ || q->f->type != FD_INODE || q->f->direct)
+    return;
+  ilock(ip);
+  iprefetch(ip, q->off, q->len);
+  iunlock(ip);
+}
+
+// Carry out one request: move q->len bytes between the file and the
+// owner's buffer, one buffer page at a time.  Returns bytes moved,
+// or -1 if nothing could be.
+static int iodo(struct ioreq *q) {
+  uint va, off, tot, m;
+  char *ka;
+  int n;
+
+  for (tot = 0; tot < q->len; tot += n) {
+    va = q->addr + tot;
+    off = q->off + tot;
+    m = min(q->len - tot, PGSIZE - va % PGSIZE);
+    if ((ka = iouserpage(q->r, va)) == 0)
+      return tot > 0 ? (int)tot : -1;
+    if (q->op == IORING_READ)
+      n = filepread(q->f, ka + va % PGSIZE, m, off);
+    else
+      n = filepwrite(q->f, ka + va % PGSIZE, m, off);
+    kfree(ka); // drop iouserpage's pin
+    if (n < 0)
+      return tot > 0 ? (int)tot : -1;
+    if (n < m) {
+      tot += n; // end of file
+      break;
+    }
+  }
+  return tot;
+}
+
+static void ioworker(void) {
+  struct ioreq *q, *batch;
+  int res;
+
+  acquire(&iow.lock);
+  for (;;) {
+    while (iow.head == 0)
+      sleep(&iow, &iow.lock);
+    batch = iow.head;
+    iow.head = 0;
+    iow.busy = 1;
+    release(&iow.lock);
+
+    // Pass 1: get every read in the batch moving on the disk.
+    for (q = batch; q; q = q->next)
+      if (!q->r->dying)
+        ioprefetch(q);
+
+    // Pass 2: complete them in submission order.
+    while ((q = batch) != 0) {
+      batch = q->next;
+      res = q->r->dying ? -1 : iodo(q);
+      fileclose(q->f);
+      acquire(&iow.lock);
+      q->r->inflight--;
+      if (!q->r->dying)
+        iopost(q->r, q->id, res);
+      q->next = iow.free;
+      iow.free = q;
+      release(&iow.lock);
+    }
+
+    acquire(&iow.lock);
+    iow.busy = 0;
+    wakeup(&iow.busy);
+  }
+}
+
+// Create the calling process's ring: one zeroed page laid out as
+// struct ioring, mapped writable in the mmap arena.  Returns its
+// user address, or -1.  The page carries two references — the
+// mapping's, returned by freevm() when the address space dies, and
+// the kernel's, dropped by iodestroy() — so neither side can pull
+// it out from under the other.
+int iosetup(void) {
+  struct proc *curproc = myproc();
+  struct iokring *r;
+  char *pg;
+  uint addr;
+  int i, start;
+
+  if (curproc->ioring)
+    return -1;
+
+  start = 0;
+  r = 0;
+  acquire(&iow.lock);
+  if (!iow.ready) {
+    iow.ready = 1;
+    start = 1;
+  }
+  for (i = 0; i < NIORING; i++) {
+    if (iow.ring[i].owner == 0) {
+      r = &iow.ring[i];
+      r->owner = curproc; // claimed; nobody else looks at it yet
+      break;
+    }
+  }
+  release(&iow.lock);
+  if (start && kthread(ioworker, "ioring") == 0)
+    panic("iosetup: no worker");
+  if (r == 0)
+    return -1;
+
+  if ((pg = kalloczero()) == 0) {
+    r->owner = 0;
+    return -1;
+  }
+  addr = PGROUNDDOWN(curproc->mmaptop - PGSIZE);
+  if (mappages(curproc->pgdir, (char *)addr, PGSIZE, V2P(pg),
+               PTE_W | PTE_U) < 0) {
+    kfree(pg);
+    r->owner = 0;
+    return -1;
+  }
+  krefinc(pg); // the mapping's reference
+  curproc->mmaptop = addr;
+  r->ring = (struct ioring *)pg;
+  r->uva = addr;
+  r->inflight = 0;
+  r->dying = 0;
+  curproc->ioring = r;
+  return addr;
+}
+
+// Hand everything the owner queued since the last call to the
+// worker, then wait until at least nwait completions are waiting to
+// be reaped (0 to just submit).  Returns the number submitted.
+// Entries are validated here, in process context; a bad one
+// completes immediately with res -1.
+int ioenter(int nwait) {
+  struct proc *curproc = myproc();
+  struct iokring *r = curproc->ioring;
+  struct ioring *ring;
+  struct iosqe sqe;
+  struct ioreq *q, **pp;
+  struct file *f;
+  int submitted = 0;
+
+  if (r == 0 || nwait < 0)
+    return -1;
+  ring = r->ring;
+
+  acquire(&iow.lock);
+  while (ring->sqhead != ring->sqtail) {
+    // Stop while the request pool is dry or the completion queue
+    // could overflow; leftovers wait for the next ioenter().
+    if (iow.free == 0 ||
+        ring->cqtail - ring->cqhead + r->inflight >= NCQE)
+      break;
+    sqe = ring->sq[ring->sqhead % NSQE];
+    ring->sqhead++;
+    f = sqe.fd >= 0 && sqe.fd < NOFILE ? curproc->ofile[sqe.fd] : 0;
+    if ((sqe.op != IORING_READ && sqe.op != IORING_WRITE) || f == 0 ||
+        f->type != FD_INODE || !uaddrok(sqe.addr, sqe.len) ||
+        (sqe.op == IORING_READ ? !f->readable : !f->writable)) {
+      iopost(r, sqe.id, -1);
+      continue;
+    }
+    q = iow.free;
+    iow.free = q->next;
+    q->r = r;
+    q->f = filedup(f); // survives a close() racing the worker
+    q->op = sqe.op;
+    q->addr = sqe.addr;
+    q->len = sqe.len;
+    q->off = sqe.off;
+    q->id = sqe.id;
+    q->next = 0;
+    for (pp = &iow.head; *pp; pp = &(*pp)->next)
+      ;
+    *pp = q;
+    r->inflight++;
+    submitted++;
+  }
+  if (submitted)
+    wakeup(&iow);
+
+  while (nwait > 0 && (int)(ring->cqtail - ring->cqhead) < nwait) {
+    if (curproc->killed) {
+      release(&iow.lock);
+      return -1;
+    }
+    sleep(r, &iow.lock);
+  }
+  release(&iow.lock);
+  return submitted;
+}
+
+// Tear down p's ring at exit: unqueue its pending requests, wait
+// out any batch the worker has in hand (its requests reference p's
+// page table), then release the page and the slot.
+void iodestroy(struct proc *p) {
+  struct iokring *r = p->ioring;
+  struct ioreq *q, **pp, *drop;
+
+  if (r == 0)
+    return;
+  acquire(&iow.lock);
+  r->dying = 1;
+  drop = 0;
+  pp = &iow.head;
+  while ((q = *pp) != 0) {
+    if (q->r == r) {
+      *pp = q->next;
+      q->next = drop;
+      drop = q;
+      r->inflight--;
+    } else
+      pp = &q->next;
+  }
+  while (iow.busy)
+    sleep(&iow.busy, &iow.lock);
+  release(&iow.lock);
+
+  // The unqueued requests' file references can't be dropped under
+  // the lock; fileclose may sleep.
+  while ((q = drop) != 0) {
+    drop = q->next;
+    fileclose(q->f);
+    acquire(&iow.lock);
+    q->next = iow.free;
+    iow.free = q;
+    release(&iow.lock);
+  }
+
+  kfree((char *)r->ring); // the kernel's reference
+  p->ioring = 0;
+  acquire(&iow.lock);
+  r->owner = 0;
+  release(&iow.lock);
+}
+
+int sys_iosetup(void) { return iosetup(); }
+
+int sys_ioenter(void) {
+  int nwait;
+
+  if (argint(0, &nwait) < 0)
+    return -1;
+  return ioenter(nwait);
+}
@@ -0,0 +1,40 @@
+// Asynchronous I/O rings, shared between kernel and user space.
+// iosetup() maps one page, laid out as struct ioring, into the
+// calling process.  To start I/O the process fills sq[sqtail % NSQE]
+// and increments sqtail, then calls ioenter() to hand the new
+// entries to the kernel; completions appear in cq[], where the
+// process reads cq[cqhead % NCQE] and increments cqhead.  All four
+// indices only ever grow.  See ioring.c.
+
+#define NSQE 64  // submission queue entries
+#define NCQE 128 // completion queue entries
+
+#define IORING_READ 0
+#define IORING_WRITE 1
+
+// One submission: op on fd, moving len bytes between the buffer at
+// addr and file offset off.  id is echoed in the completion.
+struct iosqe {
+  int op;
+  int fd;
+  uint addr;
+  uint len;
+  uint off;
+  uint id;
+};
+
+// One completion: res is bytes moved (short only at end of file),
+// or -1.
+struct iocqe {
+  uint id;
+  int res;
+};
+
+struct ioring {
+  uint sqhead; // kernel consumes submissions here
+  uint sqtail; // user publishes submissions here
+  uint cqhead; // user reaps completions here
+  uint cqtail; // kernel posts completions here
+  struct iosqe sq[NSQE];
+  struct iocqe cq[NCQE];
+};
@@ -7,21 +7,294 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// Pages stolen from another CPU's freelist per refill.  Large enough
+// to amortize the victim's lock acquisition over many local kallocs,
+// small enough not to strand memory on an idle CPU.
+#define KSTEAL 64
+
 struct run {
   struct run *next;
 };
 
-struct {
+// One freelist per CPU so the hot kalloc()/kfree() paths take only a
+// lock that no other CPU touches.  A CPU whose list runs dry steals a
+// batch from its neighbours.
+struct kmem {
   struct spinlock lock;
-  int use_lock;
   struct run *freelist;
-} kmem;
+  int n; // pages on freelist
+};
+
+static struct kmem kmems[NCPU];
+static int use_lock;
+
+// Reference counts for every physical page, so pages can be shared
+// copy-on-write between address spaces.  kalloc() hands out pages with
+// a count of one; kfree() only returns a page to a freelist once the
+// last reference is dropped.
+#define PGIDX(v) (V2P(v) / PGSIZE)
+
+static struct {
+  struct spinlock lock;
+  uchar count[PHYSTOP / PGSIZE];
+} kref;
+
+// Add a reference to the physical page at kernel address v.
+void krefinc(char *v) {
+  if ((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("krefinc");
+  acquire(&kref.lock);
+  kref.count[PGIDX(v)]++;
+  release(&kref.lock);
+}
+
+// Number of address spaces referencing the page at kernel address v.
+// A process holding a reference may treat a count of one as stable:
+// nobody else can increment it.
+int krefcount(char *v) { return kref.count[PGIDX(v)]; }
+
+// Pool of pre-zeroed pages.  kfree() junk-fills pages, so every
+// consumer that needs a clean page pays a full-page memset on what
+// are the hottest allocation paths (fork, sbrk, exec, page faults).
+// kzerod replenishes the pool in the background; kalloczero() falls
+// back to zeroing inline only when the pool is dry.
+#define NZPOOL 256 // pages kept zeroed (1MB)
+#define ZLOWAT 32  // wake kzerod below this
+
+static struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+  int ready; // kzerod is running
+} zpool;
+
+// Most physical memory is not put on a freelist at boot; kinit2()
+// just records the range and kalloc() populates it on demand, one
+// chunk at a time.  Walking (and junk-filling) a couple hundred MB
+// of pages on the boot CPU was a measurable chunk of boot time, and
+// this spreads the work across whichever CPUs first need the pages.
+#define KCHUNK (4 * 1024 * 1024)
+static struct {
+  struct spinlock lock;
+  char *next; // first byte not yet on any freelist
+  char *end;
+} kpending;
+
+// Claim the next unpopulated chunk and free its pages onto the
+// calling CPU's list.  Returns 0 once the range is exhausted.
+static int kpopulate(void) {
+  char *p, *e;
+
+  acquire(&kpending.lock);
+  p = kpending.next;
+  e = p + KCHUNK;
+  if (e > kpending.end)
+    e = kpending.end;
+  kpending.next = e;
+  release(&kpending.lock);
+  if (p >= e)
+    return 0;
+  freerange(p, e);
+  return 1;
+}
+
+// Memory-pressure notification.  memwait() parks a process until free
+// memory falls below the low watermark, so user-level caches can shed
+// pages (free() + malloctrim()) before kalloc() starts failing fork()
+// for everyone.  The check runs once per timer tick (kpresscheck from
+// trap()) rather than in kalloc() itself, keeping the hot allocation
+// path free of it and wakeup() out of kalloc()'s lock contexts.
+#define KLOWAT (PHYSTOP / PGSIZE / 32) // free pages; below this is "low"
+
+static struct {
+  struct spinlock lock;
+  int waiting; // processes parked in memwait()
+} kpress;
+
+// Free pages in the system: the per-CPU lists, the zero pool, and the
+// range kalloc() has not yet carved up.  Counts are read unlocked and
+// blocks held by the buddy lists are not included, so this is a
+// (slightly pessimistic) advisory figure, which is all the watermark
+// needs.
+static int kmemfree(void) {
+  int i, n;
+
+  n = zpool.n + (kpending.end - kpending.next) / PGSIZE;
+  for (i = 0; i < NCPU; i++)
+    n += kmems[i].n;
+  return n;
+}
+
+// Called once per tick by the timekeeping CPU: one flag test when
+// nobody is waiting.
+void kpresscheck(void) {
+  if (kpress.waiting && kmemfree() < KLOWAT)
+    wakeup(&kpress);
+}
+
+// Block until free physical memory runs low.  Returns the number of
+// free pages remaining, or -1 if killed while waiting.
+int memwait(void) {
+  acquire(&kpress.lock);
+  kpress.waiting++;
+  while (kmemfree() >= KLOWAT) {
+    if (myproc()->killed) {
+      kpress.waiting--;
+      release(&kpress.lock);
+      return -1;
+    }
+    sleep(&kpress, &kpress.lock);
+  }
+  kpress.waiting--;
+  release(&kpress.lock);
+  return kmemfree();
+}
+
+// Multi-page allocator for physically contiguous memory: DMA buffers,
+// superpage backing, large rings.  A block is a power of two pages
+// ("order" is log2 of the page count), kept on one free list per
+// order; freeing a block merges it with its buddy whenever both
+// halves are free, so large blocks survive alloc/free churn.  Blocks
+// come from the same unpopulated kpending range the per-CPU lists
+// draw on, which keeps the hot single-page paths untouched: order 0
+// just forwards to kalloc()/kfree().
+#define KMAXORDER 10 // 4MB, one kpending chunk
+
+static struct {
+  struct spinlock lock;
+  struct run *free[KMAXORDER + 1];
+} kbuddy;
+
+// Insert the range [p, e) as maximal naturally-aligned power-of-two
+// blocks.  Caller holds kbuddy.lock.
+static void kbuddyseed(char *p, char *e) {
+  struct run *r;
+  int o;
+
+  while (p < e) {
+    for (o = KMAXORDER; o > 0; o--)
+      if (V2P(p) % (PGSIZE << o) == 0 && p + (PGSIZE << o) <= e)
+        break;
+    r = (struct run *)p;
+    r->next = kbuddy.free[o];
+    kbuddy.free[o] = r;
+    p += PGSIZE << o;
+  }
+}
+
+// Claim the next unpopulated chunk for the buddy lists.  Returns 0
+// once the range is exhausted.  Caller holds kbuddy.lock.
+static int kbuddyrefill(void) {
+  char *p, *e;
+
+  acquire(&kpending.lock);
+  p = kpending.next;
+  e = p + KCHUNK;
+  if (e > kpending.end)
+    e = kpending.end;
+  kpending.next = e;
+  release(&kpending.lock);
+  if (p >= e)
+    return 0;
+  kbuddyseed(p, e);
+  return 1;
+}
+
+// Allocate 2^order physically contiguous pages.  Returns a kernel
+// pointer aligned to the block size, or 0 if no block that large is
+// available.  Blocks are owned whole: their pages must not be shared
+// with krefinc() and must come back through kfree_pages().
+char *kalloc_pages(int order) {
+  struct run *r, *h;
+  char *v;
+  int o, i;
+
+  if (order < 0 || order > KMAXORDER)
+    return 0;
+  if (order == 0)
+    return kalloc();
+
+  acquire(&kbuddy.lock);
+  for (;;) {
+    for (o = order; o <= KMAXORDER; o++)
+      if (kbuddy.free[o])
+        break;
+    if (o <= KMAXORDER)
+      break;
+    if (!kbuddyrefill()) {
+      release(&kbuddy.lock);
+      return 0;
+    }
+  }
+  r = kbuddy.free[o];
+  kbuddy.free[o] = r->next;
+  // Split until the block is the requested size; each upper half
+  // goes back on its order's list.
+  while (o > order) {
+    o--;
+    h = (struct run *)((char *)r + (PGSIZE << o));
+    h->next = kbuddy.free[o];
+    kbuddy.free[o] = h;
+  }
+  release(&kbuddy.lock);
+  v = (char *)r;
+  // The block has exactly one owner, as in kalloc().
+  for (i = 0; i < 1 << order; i++)
+    kref.count[PGIDX(v + i * PGSIZE)] = 1;
+  return v;
+}
+
+// Free a block returned by kalloc_pages().  A block's buddy is its
+// naturally-aligned neighbour of the same size; while the buddy is
+// also free, unlink it and merge the halves one order up.
+void kfree_pages(char *v, int order) {
+  struct run *r, **pp;
+  uint pa, bpa;
+  int i;
+
+  if (order == 0) {
+    kfree(v);
+    return;
+  }
+  if (order < 0 || order > KMAXORDER || v < end || V2P(v) >= PHYSTOP ||
+      V2P(v) % (PGSIZE << order))
+    panic("kfree_pages");
+
+  for (i = 0; i < 1 << order; i++) {
+    if (kref.count[PGIDX(v + i * PGSIZE)] > 1)
+      panic("kfree_pages: shared page");
+    kref.count[PGIDX(v + i * PGSIZE)] = 0;
+  }
+
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+
+  acquire(&kbuddy.lock);
+  while (order < KMAXORDER) {
+    pa = V2P(v);
+    bpa = pa ^ (PGSIZE << order);
+    for (pp = &kbuddy.free[order]; *pp; pp = &(*pp)->next)
+      if (V2P((char *)*pp) == bpa)
+        break;
+    if (*pp == 0)
+      break;
+    *pp = (*pp)->next;
+    if (bpa < pa)
+      v = (char *)P2V(bpa);
+    order++;
+  }
+  r = (struct run *)v;
+  r->next = kbuddy.free[order];
+  kbuddy.free[order] = r;
+  release(&kbuddy.lock);
+}
 
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
@@ -29,14 +302,23 @@ struct {
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
 void kinit1(void *vstart, void *vend) {
-  initlock(&kmem.lock, "kmem");
-  kmem.use_lock = 0;
+  int i;
+
+  for (i = 0; i < NCPU; i++)
+    initlock(&kmems[i].lock, "kmem");
+  initlock(&kref.lock, "kref");
+  initlock(&kpending.lock, "kpending");
+  initlock(&kbuddy.lock, "kbuddy");
+  initlock(&kpress.lock, "kpress");
+  initlock(&zpool.lock, "zpool");
+  use_lock = 0;
   freerange(vstart, vend);
 }
 
 void kinit2(void *vstart, void *vend) {
-  freerange(vstart, vend);
-  kmem.use_lock = 1;
+  kpending.next = (char *)PGROUNDUP((uint)vstart);
+  kpending.end = vend;
+  use_lock = 1;
 }
 
 void freerange(void *vstart, void *vend) {
@@ -52,34 +334,186 @@ void freerange(void *vstart, void *vend) {
 // initializing the allocator; see kinit above.)
 void kfree(char *v) {
   struct run *r;
+  struct kmem *km;
 
   if ((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Drop one reference; only the last free returns the page.
+  // (Pages freed during bootstrap have never been allocated and
+  // carry a count of zero.)
+  if (use_lock)
+    acquire(&kref.lock);
+  if (kref.count[PGIDX(v)] > 1) {
+    kref.count[PGIDX(v)]--;
+    if (use_lock)
+      release(&kref.lock);
+    return;
+  }
+  kref.count[PGIDX(v)] = 0;
+  if (use_lock)
+    release(&kref.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if (kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run *)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if (kmem.use_lock)
-    release(&kmem.lock);
+  if (!use_lock) {
+    // Boot path: single CPU, mycpu() not usable yet.
+    r->next = kmems[0].freelist;
+    kmems[0].freelist = r;
+    kmems[0].n++;
+    return;
+  }
+
+  pushcli();
+  km = &kmems[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->n++;
+  release(&km->lock);
+  popcli();
+}
+
+// Allocate a page that reads as all zeroes.
+char *kalloczero(void) {
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.freelist;
+  if (r) {
+    zpool.freelist = r->next;
+    zpool.n--;
+  }
+  if (zpool.ready && zpool.n < ZLOWAT)
+    wakeup(&zpool);
+  release(&zpool.lock);
+  if (r) {
+    r->next = 0; // the link word is the only non-zero byte
+    return (char *)r;
+  }
+  if ((r = (struct run *)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  return (char *)r;
+}
+
+static void kzerod(void) {
+  struct run *r;
+
+  acquire(&zpool.lock);
+  zpool.ready = 1;
+  for (;;) {
+    while (zpool.n >= NZPOOL)
+      sleep(&zpool, &zpool.lock);
+    release(&zpool.lock);
+    r = (struct run *)kalloc();
+    if (r)
+      memset(r, 0, PGSIZE);
+    acquire(&zpool.lock);
+    if (r == 0) {
+      // Out of memory; retry when a consumer next pokes the pool.
+      sleep(&zpool, &zpool.lock);
+      continue;
+    }
+    r->next = zpool.freelist;
+    zpool.freelist = r;
+    zpool.n++;
+  }
+}
+
+// Start the zero-page thread.  Called from the first process's
+// forkret, once the scheduler is running.
+void kzerodinit(void) {
+  if (kthread(kzerod, "kzerod") == 0)
+    panic("kzerodinit: no thread");
+}
+
+// Steal up to KSTEAL pages from some other CPU's freelist.
+// Returns a private chain of pages, or 0 if all lists are empty.
+static struct run *ksteal(int self) {
+  struct kmem *victim;
+  struct run *r, *chain;
+  int i, n;
+
+  for (i = 0; i < NCPU; i++) {
+    if (i == self)
+      continue;
+    victim = &kmems[i];
+    acquire(&victim->lock);
+    chain = 0;
+    for (n = 0; n < KSTEAL && victim->freelist; n++) {
+      r = victim->freelist;
+      victim->freelist = r->next;
+      r->next = chain;
+      chain = r;
+    }
+    victim->n -= n;
+    release(&victim->lock);
+    if (chain)
+      return chain;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 char *kalloc(void) {
-  struct run *r;
+  struct run *r, *last;
+  struct kmem *km;
+  int id, n;
+
+  if (!use_lock) {
+    r = kmems[0].freelist;
+    if (r) {
+      kmems[0].freelist = r->next;
+      kmems[0].n--;
+      kref.count[PGIDX((char *)r)] = 1;
+    }
+    return (char *)r;
+  }
+
+  pushcli();
+  id = cpuid();
+  km = &kmems[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if (r) {
+    km->freelist = r->next;
+    km->n--;
+  }
+  release(&km->lock);
+
+  // An empty list first means more of physical memory to carve up,
+  // and only then that it is worth raiding another CPU.
+  while (r == 0 && kpopulate()) {
+    acquire(&km->lock);
+    r = km->freelist;
+    if (r) {
+      km->freelist = r->next;
+      km->n--;
+    }
+    release(&km->lock);
+  }
 
-  if (kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if (r == 0 && (r = ksteal(id)) != 0 && r->next) {
+    // Keep the first stolen page; splice the rest into the local list.
+    // The chain is private, so no two kmem locks are ever held at once.
+    n = 0;
+    for (last = r->next; last->next; last = last->next)
+      n++;
+    acquire(&km->lock);
+    last->next = km->freelist;
+    km->freelist = r->next;
+    km->n += n + 1;
+    release(&km->lock);
+  }
+  popcli();
+  // A freshly allocated page has exactly one owner; no other CPU can
+  // reference it yet, so the count can be set without kref.lock.
   if (r)
-    kmem.freelist = r->next;
-  if (kmem.use_lock)
-    release(&kmem.lock);
+    kref.count[PGIDX((char *)r)] = 1;
   return (char *)r;
 }
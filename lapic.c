@@ -62,7 +62,7 @@ void lapicinit(void) {
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, TICKCOUNT);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -100,6 +100,21 @@ int lapicid(void) {
 }
 
 // Acknowledge interrupt.
+// Reprogram this CPU's timer to fire every mult base ticks.  trap()
+// stretches the period when nothing is queued behind the running
+// process and snaps it back once there is competition.
+void lapicsettick(int mult) { lapicw(TICR, TICKCOUNT * mult); }
+
+// Send a fixed-delivery IPI for vector to the CPU with the given APIC
+// id.  Used by rqput() to kick an idle CPU out of hlt when work is
+// queued for it.
+void lapicipi(uchar apicid, int vector) {
+  lapicw(ICRHI, apicid << 24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while (lapic[ICRLO] & DELIVS)
+    ;
+}
+
 void lapiceoi(void) {
   if (lapic)
     lapicw(EOI, 0);
@@ -0,0 +1,9 @@
+// One entry of the table filled in by the lockstats() system call.
+// The counters are copied without taking the lock, so a snapshot may
+// be slightly stale; good enough for finding hot locks.
+struct lockstat {
+  char name[16]; // lock name
+  uint nacquire; // times the lock was acquired
+  uint nspin;    // spin iterations spent waiting for it
+  uint holdcyc;  // cycles spent holding it (mod 2^32)
+};
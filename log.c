@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -18,7 +19,14 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the background flush frees log space.
+//
+// Commits are asynchronous: end_op() only stages the transaction
+// (the dirty blocks stay pinned in the buffer cache) and returns.
+// A dedicated flusher thread commits once no FS system call is
+// active, so transactions from many processes merge into one batched
+// commit and no caller ever waits for the log's double write unless
+// the log is out of space.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -42,6 +50,7 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int flushreq;    // flusher wakeup channel
   int dev;
   struct logheader lh;
 };
@@ -49,6 +58,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflushd(void);
 
 void initlog(int dev) {
   if (sizeof(struct logheader) >= BSIZE)
@@ -61,9 +71,16 @@ void initlog(int dev) {
   log.size = sb.nlog;
   log.dev = dev;
   recover_from_log();
+
+  if (kthread(logflushd, "logflush") == 0)
+    panic("initlog: no flusher");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.  The writes
+// are queued without waiting so the disk elevator can sort them and
+// merge neighbours into single transfers; nothing after a commit
+// depends on any individual home write, only on all of them being
+// done before the log is erased, so one barrier at the end suffices.
 static void install_trans(void) {
   int tail;
 
@@ -71,10 +88,10 @@ static void install_trans(void) {
     struct buf *lbuf = bread(log.dev, log.start + tail + 1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]);   // read dst
     memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
-    bwrite(dbuf);                           // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+    bawrite(dbuf); // queue home write; ideintr releases dbuf
   }
+  bawaitall(); // all home copies on disk before the head is cleared
 }
 
 // Read the log header from disk into the in-memory log header
@@ -116,9 +133,12 @@ void begin_op(void) {
   acquire(&log.lock);
   while (1) {
     if (log.committing) {
+      fsstat.logwait++;
       sleep(&log, &log.lock);
     } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-      // this op might exhaust log space; wait for commit.
+      // this op might exhaust log space; ask for a flush and wait.
+      fsstat.logwait++;
+      wakeup(&log.flushreq);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -129,17 +149,17 @@ void begin_op(void) {
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The transaction stays staged in the buffer cache; the background
+// flusher commits it once no system call is active, so this never
+// blocks on disk I/O.
 void end_op(void) {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if (log.committing)
     panic("log.committing");
   if (log.outstanding == 0) {
-    do_commit = 1;
-    log.committing = 1;
+    if (log.lh.n > 0)
+      wakeup(&log.flushreq);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -147,19 +167,34 @@ void end_op(void) {
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if (do_commit) {
-    // call commit w/o holding locks, since not allowed
+// Background commit thread.  Waits until a staged transaction exists
+// and the log is quiescent, then writes it out.  All transactions
+// that completed since the previous flush commit as one batch.
+static void logflushd(void) {
+  acquire(&log.lock);
+  for (;;) {
+    while (log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.flushreq, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
+
+    // commit without holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
     log.committing = 0;
     wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log.  The log blocks are
+// consecutive on disk, so queueing them all before waiting lets the
+// elevator issue the whole append as a few multi-sector transfers;
+// the single barrier before write_head() is what makes the header
+// the commit point.
 static void write_log(void) {
   int tail;
 
@@ -167,14 +202,16 @@ static void write_log(void) {
     struct buf *to = bread(log.dev, log.start + tail + 1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to); // write the log
     brelse(from);
-    brelse(to);
+    bawrite(to); // queue log append; ideintr releases the buf
   }
+  bawaitall(); // every log block on disk before the header write
 }
 
 static void commit() {
   if (log.lh.n > 0) {
+    fsstat.logcommit++;
+    fsstat.logblocks += log.lh.n;
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
     install_trans(); // Now install writes to home locations
@@ -21,9 +21,9 @@ char *fmtname(char *path) {
 }
 
 void ls(char *path) {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  char name[DIRSIZ + 1];
+  struct dent ents[16];
+  int fd, n, i;
   struct stat st;
 
   if ((fd = open(path, 0)) < 0) {
@@ -43,23 +43,15 @@ void ls(char *path) {
     break;
 
   case T_DIR:
-    if (strlen(path) + 1 + DIRSIZ + 1 > sizeof buf) {
-      printf(1, "ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf + strlen(buf);
-    *p++ = '/';
-    while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-      if (de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if (stat(buf, &st) < 0) {
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    // Each getdents batch already carries type and size, so there is
+    // no per-entry stat (and so no path resolution per name).
+    while ((n = getdents(fd, ents, sizeof(ents))) > 0) {
+      for (i = 0; i < n / (int)sizeof(ents[0]); i++) {
+        memmove(name, ents[i].name, DIRSIZ);
+        name[DIRSIZ] = 0;
+        printf(1, "%s %d %d %d\n", fmtname(name), ents[i].type, ents[i].inum,
+               ents[i].size);
       }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
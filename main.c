@@ -27,9 +27,16 @@ int main(void) {
   consoleinit();                              // console hardware
   uartinit();                                 // serial port
   pinit();                                    // process table
+  futexinit();                                // user wait queues
+  shminit();                                  // shared memory segments
+  ioinit();                                   // async I/O rings
   tvinit();                                   // trap vectors
   binit();                                    // buffer cache
+  slabinit();                                 // object caches
   fileinit();                                 // file table
+  pipeinit();                                 // pipe structures
+  mmapinit();                                 // mmap page cache
+  profinit();                                 // sampling profiler
   ideinit();                                  // disk
   startothers();                              // start other processors
   kinit2(P2V(4 * 1024 * 1024), P2V(PHYSTOP)); // must come after startothers()
@@ -40,7 +47,7 @@ int main(void) {
 
 // Other CPUs jump here from entryother.S.
 static void mpenter(void) {
-  switchkvm();
+  lcr3(V2P(kpgdir)); // mycpu()/loadpgdir() need the lapic mapped first
   seginit();
   lapicinit();
   mpmain();
@@ -50,6 +57,7 @@ static void mpenter(void) {
 static void mpmain(void) {
   cprintf("cpu%d: starting %d\n", cpuid(), cpuid());
   idtinit();                    // load idt register
+  fpuinit();                    // SSE on, FPU use traps via CR0.TS
   xchg(&(mycpu()->started), 1); // tell startothers() we're up
   scheduler();                  // start running processes
 }
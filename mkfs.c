@@ -28,10 +28,13 @@
 int nbitmap = FSSIZE / (BSIZE * 8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
+int nswap = NSWAPPAGES * (4096 / BSIZE); // swap blocks appended after the fs
 int nmeta;   // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks; // Number of data blocks
 
 int fsfd;
+int fsfd1 = -1; // second image when striping
+int stripe;     // interleave blocks across two images
 struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
@@ -73,8 +76,17 @@ int main(int argc, char *argv[]) {
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if (argc < 2) {
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // With -stripe, write two half-images: even blocks to the first,
+  // odd blocks to the second, matching the kernel's block-interleaved
+  // layout across the two IDE channels.
+  if (argc > 1 && strcmp(argv[1], "-stripe") == 0) {
+    stripe = 1;
+    argv++;
+    argc--;
+  }
+
+  if (argc < 2 + stripe) {
+    fprintf(stderr, "Usage: mkfs [-stripe img1] fs.img files...\n");
     exit(1);
   }
 
@@ -86,8 +98,18 @@ int main(int argc, char *argv[]) {
     perror(argv[1]);
     exit(1);
   }
+  if (stripe) {
+    fsfd1 = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fsfd1 < 0) {
+      perror(argv[2]);
+      exit(1);
+    }
+    argv++;
+    argc--;
+  }
 
-  // 1 fs block = 1 disk sector
+  // All sizes and offsets here are in fs blocks of BSIZE bytes; the
+  // kernel's IDE driver maps one block to BSIZE/512 disk sectors.
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -98,14 +120,16 @@ int main(int argc, char *argv[]) {
   sb.logstart = xint(2);
   sb.inodestart = xint(2 + nlog);
   sb.bmapstart = xint(2 + nlog + ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks "
-         "%u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         "%u) blocks %d swap %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, nswap, FSSIZE + nswap);
 
   freeblock = nmeta; // the first free block that we can allocate
 
-  for (i = 0; i < FSSIZE; i++)
+  for (i = 0; i < FSSIZE + nswap; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -165,12 +189,25 @@ int main(int argc, char *argv[]) {
   exit(0);
 }
 
+// Which image holds sector sec, and at what offset there.
+static int secfd(uint sec, uint *off) {
+  if (stripe) {
+    *off = (sec >> 1) * BSIZE;
+    return (sec & 1) ? fsfd1 : fsfd;
+  }
+  *off = sec * BSIZE;
+  return fsfd;
+}
+
 void wsect(uint sec, void *buf) {
-  if (lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE) {
+  uint off;
+  int fd = secfd(sec, &off);
+
+  if (lseek(fd, off, 0) != off) {
     perror("lseek");
     exit(1);
   }
-  if (write(fsfd, buf, BSIZE) != BSIZE) {
+  if (write(fd, buf, BSIZE) != BSIZE) {
     perror("write");
     exit(1);
   }
@@ -200,11 +237,14 @@ void rinode(uint inum, struct dinode *ip) {
 }
 
 void rsect(uint sec, void *buf) {
-  if (lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE) {
+  uint off;
+  int fd = secfd(sec, &off);
+
+  if (lseek(fd, off, 0) != off) {
     perror("lseek");
     exit(1);
   }
-  if (read(fsfd, buf, BSIZE) != BSIZE) {
+  if (read(fd, buf, BSIZE) != BSIZE) {
     perror("read");
     exit(1);
   }
@@ -257,7 +297,7 @@ void iappend(uint inum, void *xp, int n) {
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if (fbn < NDIRECT + NINDIRECT) {
       if (xint(din.addrs[NDIRECT]) == 0) {
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -267,6 +307,23 @@ void iappend(uint inum, void *xp, int n) {
         wsect(xint(din.addrs[NDIRECT]), (char *)indirect);
       }
       x = xint(indirect[fbn - NDIRECT]);
+    } else {
+      uint dbn = fbn - NDIRECT - NINDIRECT;
+      if (xint(din.addrs[NDIRECT + 1]) == 0) {
+        din.addrs[NDIRECT + 1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT + 1]), (char *)indirect);
+      if (indirect[dbn / NINDIRECT] == 0) {
+        indirect[dbn / NINDIRECT] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT + 1]), (char *)indirect);
+      }
+      x = xint(indirect[dbn / NINDIRECT]);
+      rsect(x, (char *)indirect);
+      if (indirect[dbn % NINDIRECT] == 0) {
+        indirect[dbn % NINDIRECT] = xint(freeblock++);
+        wsect(x, (char *)indirect);
+      }
+      x = xint(indirect[dbn % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -6,10 +6,16 @@
 
 // Control Register flags
 #define CR0_PE 0x00000001 // Protection Enable
+#define CR0_MP 0x00000002 // Monitor coProcessor (TS applies to wait/fwait)
+#define CR0_EM 0x00000004 // Emulation; must be clear for FPU/SSE
+#define CR0_TS 0x00000008 // Task Switched; FPU/SSE use traps (T_DEVICE)
+#define CR0_NE 0x00000020 // Numeric Error via exception, not IRQ13
 #define CR0_WP 0x00010000 // Write Protect
 #define CR0_PG 0x80000000 // Paging
 
-#define CR4_PSE 0x00000010 // Page size extension
+#define CR4_PSE 0x00000010      // Page size extension
+#define CR4_OSFXSR 0x00000200   // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT 0x400    // SSE exceptions via T_SIMDERR
 
 // various segment selectors.
 #define SEG_KCODE 1 // kernel code
@@ -85,6 +91,7 @@ struct segdesc {
 #define NPDENTRIES 1024 // # directory entries per page directory
 #define NPTENTRIES 1024 // # PTEs per page table
 #define PGSIZE 4096     // bytes mapped by a page
+#define PTSIZE (NPTENTRIES * PGSIZE) // bytes mapped by a PTE_PS superpage
 
 #define PTXSHIFT 12 // offset of PTX in a linear address
 #define PDXSHIFT 22 // offset of PDX in a linear address
@@ -93,10 +100,13 @@ struct segdesc {
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
 // Page table/directory entry flags.
-#define PTE_P 0x001  // Present
-#define PTE_W 0x002  // Writeable
-#define PTE_U 0x004  // User
-#define PTE_PS 0x080 // Page Size
+#define PTE_P 0x001   // Present
+#define PTE_W 0x002   // Writeable
+#define PTE_U 0x004   // User
+#define PTE_A 0x020   // Accessed (set by hardware)
+#define PTE_PS 0x080  // Page Size
+#define PTE_COW 0x200 // Copy-on-write (software, one of the AVL bits)
+#define PTE_SWAP 0x400 // Paged out (software; PTE_P clear, slot in addr bits)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte) ((uint)(pte) & ~0xFFF)
@@ -1,13 +1,21 @@
 #define NPROC 64                  // maximum number of processes
 #define KSTACKSIZE 4096           // size of per-process kernel stack
 #define NCPU 8                    // maximum number of CPUs
-#define NOFILE 16                 // open files per process
-#define NFILE 100                 // open files per system
-#define NINODE 50                 // maximum number of active i-nodes
+#define NOFILE 128                // open files per process
+#define TICKCOUNT 10000000        // lapic bus cycles per timer tick
+#define TICKSTRETCH 8             // timer period multiplier for a lone job
+#define NINODE 200                // maximum number of active i-nodes
 #define NDEV 10                   // maximum major device number
 #define ROOTDEV 1                 // device number of file system root disk
+#define TMPDEV 2                  // device number of the RAM tmpfs (tmpfs.c)
 #define MAXARG 32                 // max exec arguments
 #define MAXOPBLOCKS 10            // max # of blocks any FS op writes
 #define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3)    // size of disk block cache
+#define NBUF (MAXOPBLOCKS * 12)   // size of disk block cache
+#define NRABLOCKS 4               // blocks of readahead on sequential reads
 #define FSSIZE 1000               // size of file system in blocks
+#define NSWAPPAGES 2048           // pages of on-disk swap space (8MB)
+#define NSHM 8                    // shared memory segments, system-wide
+#define SHMMAXPG 16               // max pages per shared memory segment
+#define NSHMATT 4                 // segments attached per process
+#define NREGLOCK 512              // spinlocks tracked for lockstats()
@@ -0,0 +1,214 @@
+// Kernel and syscall microbenchmarks.  Each test reports its
+// iteration count, average cycles per operation (rdtsc), and elapsed
+// ticks, so kernel changes can be compared run to run:
+//
+//   syscall       null-syscall cost (getpid)
+//   fork          fork + exit + wait round trip
+//   exec          fork + exec + exit + wait (re-execs this binary)
+//   pipe-bw       4096-byte pipe writes to a draining reader
+//   pipe-lat      one-byte ping-pong between two pipes
+//   file-write    sequential 4096-byte writes
+//   file-read     sequential 4096-byte reads
+//   file-rand     512-byte preads at pseudo-random offsets
+//   sbrk          allocate-and-touch, one page per op
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define CHUNK 4096
+#define FILESIZE (32 * CHUNK)
+#define TESTFILE "perftest.dat"
+
+static char buf[CHUNK];
+
+// Low 32 bits of the cycle counter; deltas below stay well under
+// 2^32 cycles, and 64-bit math would drag in libgcc helpers.
+static uint rdtsc(void) {
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return lo;
+}
+
+static uint randseed = 1;
+
+static uint rnd(void) {
+  randseed = randseed * 1664525 + 1013904223;
+  return randseed;
+}
+
+static void report(char *name, uint cycles, int iters, int ticks) {
+  printf(1, "%s: %d iters, %d cycles/op, %d ticks\n", name, iters,
+         (int)(cycles / iters), ticks);
+}
+
+static void syscalltest(void) {
+  uint t0;
+  int i, n = 100000, u0;
+
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++)
+    getpid();
+  report("syscall", rdtsc() - t0, n, uptime() - u0);
+}
+
+static void forktest(void) {
+  uint t0;
+  int i, n = 500, u0;
+
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++) {
+    if (fork() == 0)
+      exit();
+    wait();
+  }
+  report("fork", rdtsc() - t0, n, uptime() - u0);
+}
+
+static void exectest(char *self) {
+  uint t0;
+  int i, n = 100, u0;
+  char *argv[3];
+
+  argv[0] = self;
+  argv[1] = "exec-child";
+  argv[2] = 0;
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++) {
+    if (fork() == 0) {
+      exec(self, argv);
+      printf(2, "perftest: exec %s failed\n", self);
+      exit();
+    }
+    wait();
+  }
+  report("exec", rdtsc() - t0, n, uptime() - u0);
+}
+
+static void pipebwtest(void) {
+  uint t0;
+  int i, n = 1024, u0, fds[2]; // 4 MB through the pipe
+
+  if (pipe(fds) < 0) {
+    printf(2, "perftest: pipe failed\n");
+    exit();
+  }
+  if (fork() == 0) {
+    close(fds[1]);
+    while (read(fds[0], buf, CHUNK) > 0)
+      ;
+    exit();
+  }
+  close(fds[0]);
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++)
+    write(fds[1], buf, CHUNK);
+  report("pipe-bw", rdtsc() - t0, n, uptime() - u0);
+  close(fds[1]);
+  wait();
+}
+
+static void pipelattest(void) {
+  uint t0;
+  int i, n = 5000, u0, ping[2], pong[2];
+  char c = 'x';
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf(2, "perftest: pipe failed\n");
+    exit();
+  }
+  if (fork() == 0) {
+    close(ping[1]);
+    close(pong[0]);
+    while (read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++) {
+    write(ping[1], &c, 1);
+    read(pong[0], &c, 1);
+  }
+  report("pipe-lat", rdtsc() - t0, n, uptime() - u0);
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+}
+
+static void filetest(void) {
+  uint t0;
+  int i, n = FILESIZE / CHUNK, nr = 1000, u0, fd;
+
+  unlink(TESTFILE);
+  if ((fd = open(TESTFILE, O_CREATE | O_RDWR)) < 0) {
+    printf(2, "perftest: create failed\n");
+    exit();
+  }
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++)
+    write(fd, buf, CHUNK);
+  report("file-write", rdtsc() - t0, n, uptime() - u0);
+  close(fd);
+
+  if ((fd = open(TESTFILE, O_RDONLY)) < 0) {
+    printf(2, "perftest: open failed\n");
+    exit();
+  }
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < n; i++)
+    read(fd, buf, CHUNK);
+  report("file-read", rdtsc() - t0, n, uptime() - u0);
+
+  u0 = uptime();
+  t0 = rdtsc();
+  for (i = 0; i < nr; i++)
+    pread(fd, buf, 512, rnd() % (FILESIZE - 512));
+  report("file-rand", rdtsc() - t0, nr, uptime() - u0);
+  close(fd);
+  unlink(TESTFILE);
+}
+
+static void sbrktest(void) {
+  uint t0;
+  int i, n = 256, u0; // one page per iteration
+  char *p;
+
+  u0 = uptime();
+  t0 = rdtsc();
+  if ((p = sbrk(n * 4096)) == (char *)-1) {
+    printf(2, "perftest: sbrk failed\n");
+    exit();
+  }
+  for (i = 0; i < n; i++)
+    p[i * 4096] = 1;
+  report("sbrk", rdtsc() - t0, n, uptime() - u0);
+  sbrk(-n * 4096);
+}
+
+int main(int argc, char *argv[]) {
+  // The exec benchmark re-runs this binary; exit before doing work.
+  if (argc > 1 && strcmp(argv[1], "exec-child") == 0)
+    exit();
+
+  printf(1, "perftest starting\n");
+  syscalltest();
+  forktest();
+  exectest(argv[0]);
+  pipebwtest();
+  pipelattest();
+  filetest();
+  sbrktest();
+  printf(1, "perftest done\n");
+  exit();
+}
@@ -8,26 +8,51 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define NPIPEPAGE 16                  // ring pages per pipe
+#define PIPESIZE (NPIPEPAGE * PGSIZE) // 64KB
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;    // number of bytes read
-  uint nwrite;   // number of bytes written
-  int readopen;  // read fd is still open
-  int writeopen; // write fd is still open
+  char *data[NPIPEPAGE]; // ring storage, one page per slot
+  uint nread;            // number of bytes read
+  uint nwrite;           // number of bytes written
+  int readopen;          // read fd is still open
+  int writeopen;         // write fd is still open
+  int splicing;          // a splice owns the read side; readers wait
 };
 
+// Pipe structures come from a slab cache (slab.c): a struct pipe is
+// ~100 bytes, so carving it from whole kalloc() pages wasted most of
+// a page per pipe.  The ring storage stays page-granular.
+static struct kcache *pipecache;
+
+void pipeinit(void) { pipecache = kcachemk("pipe", sizeof(struct pipe)); }
+
+// Free a pipe's ring pages and the pipe itself.
+static void pipefree(struct pipe *p) {
+  int i;
+
+  for (i = 0; i < NPIPEPAGE; i++)
+    if (p->data[i])
+      kfree(p->data[i]);
+  kcachefree(pipecache, p);
+}
+
 int pipealloc(struct file **f0, struct file **f1) {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
   if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if ((p = (struct pipe *)kalloc()) == 0)
+  if ((p = (struct pipe *)kcachealloc(pipecache)) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for (i = 0; i < NPIPEPAGE; i++) {
+    if ((p->data[i] = kalloc()) == 0)
+      goto bad;
+  }
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -46,7 +71,7 @@ int pipealloc(struct file **f0, struct file **f1) {
   // PAGEBREAK: 20
 bad:
   if (p)
-    kfree((char *)p);
+    pipefree(p);
   if (*f0)
     fileclose(*f0);
   if (*f1)
@@ -65,49 +90,155 @@ void pipeclose(struct pipe *p, int writable) {
   }
   if (p->readopen == 0 && p->writeopen == 0) {
     release(&p->lock);
-    kfree((char *)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Copy n bytes between the ring and addr, starting at ring offset
+// pos, splitting at page and ring-wrap boundaries.  Caller must hold
+// p->lock and have checked that the bytes are available.
+static void pipecopy(struct pipe *p, uint pos, char *addr, int n, int towards) {
+  uint off;
+  int m;
+
+  while (n > 0) {
+    off = pos % PIPESIZE;
+    m = PGSIZE - off % PGSIZE; // rest of this ring page
+    if (m > n)
+      m = n;
+    if (towards)
+      memmove(p->data[off / PGSIZE] + off % PGSIZE, addr, m);
+    else
+      memmove(addr, p->data[off / PGSIZE] + off % PGSIZE, m);
+    pos += m;
+    addr += m;
+    n -= m;
+  }
+}
+
 // PAGEBREAK: 40
 int pipewrite(struct pipe *p, char *addr, int n) {
-  int i;
+  int tot, m;
 
+  // Resolve the user buffer's pages before taking the pipe lock, and
+  // again after every sleep (a sleeping process's pages can be
+  // swapped out): pipecopy must not fault under the lock, since
+  // repairing a page sleeps on disk I/O.
+  if (uprefault(addr, n) < 0)
+    return -1;
   acquire(&p->lock);
-  for (i = 0; i < n; i++) {
+  for (tot = 0; tot < n;) {
     while (p->nwrite == p->nread + PIPESIZE) { // DOC: pipewrite-full
       if (p->readopen == 0 || myproc()->killed) {
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock); // DOC: pipewrite-sleep
+      release(&p->lock);
+      if (uprefault(addr + tot, n - tot) < 0)
+        return -1;
+      acquire(&p->lock);
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    // Copy as much as fits; the reader only sleeps on an empty
+    // pipe, so one wakeup per empty->nonempty transition suffices.
+    m = PIPESIZE - (p->nwrite - p->nread);
+    if (m > n - tot)
+      m = n - tot;
+    pipecopy(p, p->nwrite, addr + tot, m, 1);
+    if (p->nwrite == p->nread)
+      wakeup(&p->nread); // DOC: pipewrite-wakeup1
+    p->nwrite += m;
+    tot += m;
   }
-  wakeup(&p->nread); // DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
 int piperead(struct pipe *p, char *addr, int n) {
-  int i;
+  int wasfull;
 
+  // See pipewrite: the buffer's pages must be resolved before the
+  // copy under the lock, and re-resolved after every sleep.
+  if (uprefault(addr, n) < 0)
+    return -1;
   acquire(&p->lock);
-  while (p->nread == p->nwrite && p->writeopen) { // DOC: pipe-empty
-    if (myproc()->killed) {
-      release(&p->lock);
+  for (;;) {
+    if (p->splicing) { // splice writes straight out of the ring
+      sleep(&p->splicing, &p->lock);
+    } else if (p->nread == p->nwrite && p->writeopen) { // DOC: pipe-empty
+      if (myproc()->killed) {
+        release(&p->lock);
+        return -1;
+      }
+      sleep(&p->nread, &p->lock); // DOC: piperead-sleep
+    } else
+      break;
+    release(&p->lock);
+    if (uprefault(addr, n) < 0)
       return -1;
-    }
-    sleep(&p->nread, &p->lock); // DOC: piperead-sleep
+    acquire(&p->lock);
   }
-  for (i = 0; i < n; i++) { // DOC: piperead-copy
-    if (p->nread == p->nwrite)
+  // Copy out whatever is available; the writer only sleeps on a full
+  // pipe, so it needs a wakeup just on the full->notfull transition.
+  wasfull = (p->nwrite == p->nread + PIPESIZE);
+  if (n > p->nwrite - p->nread)
+    n = p->nwrite - p->nread;
+  pipecopy(p, p->nread, addr, n, 0); // DOC: piperead-copy
+  p->nread += n;
+  if (wasfull && n > 0)
+    wakeup(&p->nwrite); // DOC: piperead-wakeup
+  release(&p->lock);
+  return n;
+}
+
+// Move up to n bytes from the pipe into file f without passing
+// through user memory: each contiguous ring chunk is handed to
+// filewrite() directly, so the only copy left is into the buffer
+// cache.  The splicing flag parks ordinary readers while the lock is
+// dropped around filewrite(); the writer is unaffected because the
+// unconsumed region of the ring is never overwritten.
+int pipesplice(struct pipe *p, struct file *f, int n) {
+  int tot, m, r, wasfull;
+  uint off;
+
+  acquire(&p->lock);
+  while (p->splicing)
+    sleep(&p->splicing, &p->lock);
+  p->splicing = 1;
+
+  for (tot = 0; tot < n;) {
+    while (p->nread == p->nwrite && p->writeopen) {
+      if (myproc()->killed)
+        goto out;
+      sleep(&p->nread, &p->lock);
+    }
+    if (p->nread == p->nwrite) // writer closed and ring drained
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+
+    off = p->nread % PIPESIZE;
+    m = PGSIZE - off % PGSIZE; // rest of this ring page
+    if (m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if (m > n - tot)
+      m = n - tot;
+
+    release(&p->lock);
+    r = filewrite(f, p->data[off / PGSIZE] + off % PGSIZE, m);
+    acquire(&p->lock);
+    if (r <= 0)
+      break;
+
+    wasfull = (p->nwrite == p->nread + PIPESIZE);
+    p->nread += r;
+    tot += r;
+    if (wasfull)
+      wakeup(&p->nwrite);
   }
-  wakeup(&p->nwrite); // DOC: piperead-wakeup
+
+out:
+  p->splicing = 0;
+  wakeup(&p->splicing);
   release(&p->lock);
-  return i;
+  return (tot == 0 && myproc()->killed) ? -1 : tot;
 }
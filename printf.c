@@ -2,7 +2,22 @@
 #include "stat.h"
 #include "user.h"
 
-static void putc(int fd, char c) { write(fd, &c, 1); }
+// Output accumulates here and goes out in one write() per printf call
+// (or per 128 bytes) instead of one syscall per character.
+static char obuf[128];
+static int on;
+
+static void oflush(int fd) {
+  if (on > 0)
+    write(fd, obuf, on);
+  on = 0;
+}
+
+static void putc(int fd, char c) {
+  obuf[on++] = c;
+  if (on == sizeof(obuf))
+    oflush(fd);
+}
 
 static void printint(int fd, int xx, int base, int sgn) {
   static char digits[] = "0123456789ABCDEF";
@@ -74,4 +89,5 @@ void printf(int fd, const char *fmt, ...) {
       state = 0;
     }
   }
+  oflush(fd);
 }
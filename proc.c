@@ -6,12 +6,65 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "traps.h"
+#include "fs.h"
+#include "file.h"
+#include "procstat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *freelist; // UNUSED slots, chained through p->fnext
 } ptable;
 
+// Freed kernel stacks, chained through their first word, so a fork
+// can reuse one without a round trip through kalloc().  Protected by
+// ptable.lock, which both push (wait) and pop (allocproc) hold anyway.
+#define NSTACKPOOL 16
+static struct {
+  char *head;
+  int n;
+} stackpool;
+
+// Per-CPU multi-level feedback run queues.  Every RUNNABLE process is
+// on exactly one queue, so pick-next is O(1) instead of a scan over
+// all NPROC slots.  A process that burns through its time slice sinks
+// one level; a process that sleeps (in console reads, pipes, disk) is
+// boosted back to the top on wakeup, and a periodic boost keeps
+// long-running jobs from starving.
+//
+// Each CPU's queues have their own lock, so an idle CPU spins on its
+// local queue instead of ptable.lock and enqueue/dequeue from
+// different CPUs never contend.  A CPU whose queues are empty steals
+// from another CPU's.  ptable.lock still guards process state
+// transitions and the context switch itself: a stolen process cannot
+// be dispatched until the CPU that enqueued it has released
+// ptable.lock, which happens only after its context is saved.
+//
+// Lock order: ptable.lock before any runq lock; at most one runq lock
+// is ever held at a time.
+#define NQUEUE 3          // number of priority levels
+#define QSLICE(lv) (1 << (lv)) // ticks per slice at each level
+#define BOOSTTICKS 100    // per-CPU priority boost interval
+
+static struct runq {
+  struct spinlock lock;
+  struct proc *head[NQUEUE];
+  struct proc *tail[NQUEUE];
+  uint lastboost;
+} runqs[NCPU];
+
+// Hashed wait queues: every SLEEPING process is chained (via
+// p->wnext) on the bucket its channel hashes to, so wakeup() visits
+// only the sleepers of one bucket instead of scanning all of ptable.
+// The queues are protected by ptable.lock, which sleep and wakeup
+// hold anyway for the state transitions.
+#define NWQ 64
+#define WHASH(chan) ((((uint)(chan)) * 2654435761u) >> 26)
+
+static struct proc *wq[NWQ];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -20,7 +73,193 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
-void pinit(void) { initlock(&ptable.lock, "ptable"); }
+// Snapshot the resource counters of every in-use process into dst,
+// one struct procstat per process, as many whole records as fit.
+// Read handler for the PROCSTAT device.
+static int procstatread(struct inode *ip, char *dst, int n) {
+  struct procstat st;
+  struct proc *p;
+  int tot = 0;
+
+  // The copies below run under ptable.lock; resolve the user buffer's
+  // pages first (see uprefault), since repairing one under the lock
+  // would sleep on disk I/O or re-enter ptable.lock.
+  if (uprefault(dst, n) < 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    if (p->state == UNUSED)
+      continue;
+    if (n - tot < sizeof(st))
+      break;
+    st.pid = p->pid;
+    st.state = p->state;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    st.cputicks = p->cputicks;
+    st.nswitch = p->nswitch;
+    st.npgflt = p->npgflt;
+    st.rbytes = p->rbytes;
+    st.wbytes = p->wbytes;
+    memmove(dst + tot, (char *)&st, sizeof(st));
+    tot += sizeof(st);
+  }
+  release(&ptable.lock);
+  return tot;
+}
+
+void pinit(void) {
+  struct proc *p;
+  int i;
+
+  initlock(&ptable.lock, "ptable");
+  for (i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    p->fnext = ptable.freelist;
+    ptable.freelist = p;
+  }
+  devsw[PROCSTAT].read = procstatread;
+}
+
+// Clamp an MLFQ level into the band p's nice value allows.  Positive
+// nice raises the floor, so a background process never occupies the
+// top queues even right after a boost; negative nice lowers the
+// ceiling, so a latency-critical process is never demoted off them
+// no matter how much CPU it burns.
+static int nicelevel(struct proc *p, int lv) {
+  int lo = p->nice > 0 ? p->nice : 0;
+  int hi = NQUEUE - 1 + (p->nice < 0 ? p->nice : 0);
+
+  if (lv < lo)
+    return lo;
+  if (lv > hi)
+    return hi;
+  return lv;
+}
+
+// Append p to the tail of its level's queue on its preferred CPU.
+// p must be RUNNABLE and off every queue.
+static void rqput(struct proc *p) {
+  struct runq *rq = &runqs[p->rqcpu];
+  struct cpu *tc;
+
+  p->qlevel = nicelevel(p, p->qlevel);
+  acquire(&rq->lock);
+  p->qnext = 0;
+  if (rq->tail[p->qlevel])
+    rq->tail[p->qlevel]->qnext = p;
+  else
+    rq->head[p->qlevel] = p;
+  rq->tail[p->qlevel] = p;
+  release(&rq->lock);
+
+  // If the target CPU is parked in hlt (see scheduler()), kick it with
+  // an IPI.  Claiming the flag with xchg means a burst of enqueues
+  // sends a single IPI, and the locked acquire above orders the queue
+  // append before the flag read: either the idler's re-check sees p,
+  // or we see the idler's flag and wake it.
+  tc = &cpus[p->rqcpu];
+  if (tc != mycpu() && tc->idle && xchg(&tc->idle, 0))
+    lapicipi(tc->apicid, T_IRQ0 + IRQ_WAKE);
+}
+
+// Pop the head of rq's highest-priority non-empty queue.
+// Caller must hold rq->lock.  Returns 0 if all queues are empty.
+static struct proc *rqpop(struct runq *rq) {
+  struct proc *p;
+  int lv;
+
+  for (lv = 0; lv < NQUEUE; lv++) {
+    if ((p = rq->head[lv]) != 0) {
+      rq->head[lv] = p->qnext;
+      if (rq->head[lv] == 0)
+        rq->tail[lv] = 0;
+      p->qnext = 0;
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Take the next process off this CPU's own queues.
+static struct proc *rqget(struct runq *rq) {
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = rqpop(rq);
+  release(&rq->lock);
+  return p;
+}
+
+// Does this CPU have anything waiting on its run queues?  The
+// dynamic timer (trap.c) stretches the tick when the running process
+// is alone.  The unlocked reads are fine: a stale answer only moves
+// one preemption check by a tick.
+int rqempty(void) {
+  struct runq *rq = &runqs[cpuid()];
+  int lv;
+
+  for (lv = 0; lv < NQUEUE; lv++)
+    if (rq->head[lv])
+      return 0;
+  return 1;
+}
+
+// Steal a process from some other CPU's run queues.
+// Returns 0 if every queue in the system is empty.
+static struct proc *rqsteal(int self) {
+  struct proc *p;
+  int i;
+
+  for (i = 0; i < ncpu; i++) {
+    if (i == self)
+      continue;
+    acquire(&runqs[i].lock);
+    p = rqpop(&runqs[i]);
+    release(&runqs[i].lock);
+    if (p)
+      return p;
+  }
+  return 0;
+}
+
+// Periodic priority boost: move every process queued on this CPU back
+// to the top level its nice value allows, so CPU-bound processes
+// cannot be starved.  Each level's chain is detached before being
+// redistributed, so a process whose band keeps it at its current
+// level is simply re-appended.
+static void rqboost(struct runq *rq) {
+  struct proc *p, *next;
+  int lv;
+
+  acquire(&rq->lock);
+  for (lv = 1; lv < NQUEUE; lv++) {
+    p = rq->head[lv];
+    rq->head[lv] = rq->tail[lv] = 0;
+    while (p) {
+      next = p->qnext;
+      p->qlevel = nicelevel(p, 0);
+      p->qticks = 0;
+      p->qnext = 0;
+      if (rq->tail[p->qlevel])
+        rq->tail[p->qlevel]->qnext = p;
+      else
+        rq->head[p->qlevel] = p;
+      rq->tail[p->qlevel] = p;
+      p = next;
+    }
+  }
+  rq->lastboost = ticks;
+  release(&rq->lock);
+}
+
+// Make p runnable and place it on a run queue.
+// Caller must hold ptable.lock.
+static void setrunnable(struct proc *p) {
+  p->state = RUNNABLE;
+  rqput(p);
+}
 
 // Must be called with interrupts disabled
 int cpuid() { return mycpu() - cpus; }
@@ -62,28 +301,61 @@ struct proc *myproc(void) {
 // Otherwise return 0.
 static struct proc *allocproc(void) {
   struct proc *p;
-  char *sp;
+  char *sp, *kstack;
 
   acquire(&ptable.lock);
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if ((p = ptable.freelist) == 0) {
+    release(&ptable.lock);
+    return 0;
+  }
+  ptable.freelist = p->fnext;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->swapping = 0;
+  p->nice = 0;
+  p->qlevel = 0;
+  p->qticks = 0;
+  p->qnext = 0;
+  p->wnext = 0;
+  p->exeip = 0;
+  p->nseg = 0;
+  memset(p->vmas, 0, sizeof(p->vmas));
+  memset(p->shms, 0, sizeof(p->shms));
+  p->mmaptop = MMAPTOP;
+  p->ioring = 0;
+  p->cputicks = 0;
+  p->nswitch = 0;
+  p->npgflt = 0;
+  p->rbytes = 0;
+  p->wbytes = 0;
+  p->usedfpu = 0;
+  pushcli();
+  p->rqcpu = cpuid();
+  popcli();
+
+  // Reuse a pooled kernel stack if one is available; pooled stacks
+  // skip the allocator entirely.
+  kstack = 0;
+  if (stackpool.head) {
+    kstack = stackpool.head;
+    stackpool.head = *(char **)kstack;
+    stackpool.n--;
+  }
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if ((p->kstack = kalloc()) == 0) {
+  if (kstack == 0 && (kstack = kalloc()) == 0) {
+    acquire(&ptable.lock);
     p->state = UNUSED;
+    p->fnext = ptable.freelist;
+    ptable.freelist = p;
+    release(&ptable.lock);
     return 0;
   }
+  p->kstack = kstack;
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -134,9 +406,55 @@ void userinit(void) {
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&ptable.lock);
+}
+
+// Return a half-built EMBRYO slot to the free list, pooling its
+// kernel stack.  For allocproc() callers whose later setup failed.
+static void unusedproc(struct proc *p) {
+  acquire(&ptable.lock);
+  if (stackpool.n < NSTACKPOOL) {
+    *(char **)p->kstack = stackpool.head;
+    stackpool.head = p->kstack;
+    stackpool.n++;
+  } else
+    kfree(p->kstack);
+  p->kstack = 0;
+  p->state = UNUSED;
+  p->fnext = ptable.freelist;
+  ptable.freelist = p;
+  release(&ptable.lock);
+}
 
+// Create a kernel-only thread running fn, which must not return.
+// The thread is a normal process entry with a kernel page table and
+// no user half; it is scheduled like any other process and may sleep.
+// Returns the new process, or 0 on failure.
+struct proc *kthread(void (*fn)(void), char *name) {
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    return 0;
+  if ((p->pgdir = setupkvm()) == 0) {
+    unusedproc(p);
+    return 0;
+  }
+
+  // allocproc arranged for the context to "return" to trapret via
+  // forkret; send it to fn instead.  forkret still runs first and
+  // releases ptable.lock.
+  *(uint *)((char *)p->context + sizeof *p->context) = (uint)fn;
+
+  p->parent = initproc;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  setrunnable(p);
   release(&ptable.lock);
+
+  return p;
 }
 
 // Grow current process's memory by n bytes.
@@ -147,8 +465,12 @@ int growproc(int n) {
 
   sz = curproc->sz;
   if (n > 0) {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Grow lazily: just extend the size and let the page fault
+    // handler allocate and zero pages on first touch, so reserving a
+    // large arena costs no page allocations up front.
+    if (sz + n >= KERNBASE || sz + n < sz)
       return -1;
+    sz += n;
   } else if (n < 0) {
     if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -173,9 +495,16 @@ int fork(void) {
 
   // Copy process state from proc.
   if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) {
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    unusedproc(np);
+    return -1;
+  }
+
+  // Child attaches to the same shared memory segments.
+  if (shmfork(curproc, np) < 0) {
+    shmexit(np);
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    unusedproc(np);
     return -1;
   }
   np->sz = curproc->sz;
@@ -188,16 +517,94 @@ int fork(void) {
   for (i = 0; i < NOFILE; i++)
     if (curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
+  memmove(np->fdmap, curproc->fdmap, sizeof(np->fdmap));
   np->cwd = idup(curproc->cwd);
 
+  // Child demand-pages from the same executable.
+  if (curproc->exeip)
+    np->exeip = idup(curproc->exeip);
+  np->nseg = curproc->nseg;
+  for (i = 0; i < curproc->nseg; i++)
+    np->segs[i] = curproc->segs[i];
+
+  // Child shares the file mappings; its pages fault in on demand.
+  for (i = 0; i < NVMA; i++) {
+    if (curproc->vmas[i].ip) {
+      np->vmas[i] = curproc->vmas[i];
+      idup(np->vmas[i].ip);
+    }
+  }
+  np->mmaptop = curproc->mmaptop;
+  np->nice = curproc->nice;
+
+  // The child inherits the parent's FPU state.  If that state is live
+  // in this CPU's registers, snapshot it first (TS is clear while we
+  // own the FPU, so the fxsave cannot trap).
+  np->usedfpu = curproc->usedfpu;
+  if (curproc->usedfpu) {
+    pushcli();
+    if (mycpu()->fpuproc == curproc)
+      fxsave(curproc->fpstate);
+    popcli();
+    memmove(np->fpstate, curproc->fpstate, sizeof(np->fpstate));
+  }
+
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  setrunnable(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a new process running the executable at path, as if by
+// fork+exec but without building and immediately discarding a clone
+// of the parent's address space.  The child inherits the parent's
+// open files and working directory; the parent waits() for it as for
+// a forked child.  Returns the child's pid, or -1 on failure.
+int spawn(char *path, char **argv) {
+  struct execimg img;
+  struct proc *np;
+  struct proc *curproc = myproc();
+  int i, pid;
+
+  if ((np = allocproc()) == 0)
+    return -1;
+  if (loadimage(path, argv, &img) < 0) {
+    unusedproc(np);
+    return -1;
+  }
+
+  np->pgdir = img.pgdir;
+  np->sz = img.sz;
+  np->parent = curproc;
+  // Parent's trap frame donates sane segment registers and eflags;
+  // entry point and stack come from the new image.
+  *np->tf = *curproc->tf;
+  np->tf->eip = img.entry;
+  np->tf->esp = img.sp;
+  np->exeip = img.exeip;
+  np->nseg = img.nseg;
+  for (i = 0; i < img.nseg; i++)
+    np->segs[i] = img.segs[i];
+
+  for (i = 0; i < NOFILE; i++)
+    if (curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  memmove(np->fdmap, curproc->fdmap, sizeof(np->fdmap));
+  np->cwd = idup(curproc->cwd);
+  np->nice = curproc->nice;
+  safestrcpy(np->name, img.name, sizeof(np->name));
 
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  setrunnable(np);
   release(&ptable.lock);
 
   return pid;
@@ -221,11 +628,23 @@ void exit(void) {
       curproc->ofile[fd] = 0;
     }
   }
+  memset(curproc->fdmap, 0, sizeof(curproc->fdmap));
 
   begin_op();
   iput(curproc->cwd);
+  if (curproc->exeip)
+    iput(curproc->exeip);
+  for (fd = 0; fd < NVMA; fd++) {
+    if (curproc->vmas[fd].ip) {
+      iput(curproc->vmas[fd].ip);
+      curproc->vmas[fd].ip = 0;
+    }
+  }
   end_op();
   curproc->cwd = 0;
+  curproc->exeip = 0;
+  shmexit(curproc);
+  iodestroy(curproc);
 
   acquire(&ptable.lock);
 
@@ -265,7 +684,12 @@ int wait(void) {
       if (p->state == ZOMBIE) {
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
+        if (stackpool.n < NSTACKPOOL) {
+          *(char **)p->kstack = stackpool.head;
+          stackpool.head = p->kstack;
+          stackpool.n++;
+        } else
+          kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
         p->pid = 0;
@@ -273,6 +697,8 @@ int wait(void) {
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
+        p->fnext = ptable.freelist;
+        ptable.freelist = p;
         release(&ptable.lock);
         return pid;
       }
@@ -302,29 +728,80 @@ void scheduler(void) {
   struct cpu *c = mycpu();
   c->proc = 0;
 
+  struct runq *rq = &runqs[c - cpus];
+
   for (;;) {
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-      if (p->state != RUNNABLE)
-        continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
+    if (ticks - rq->lastboost >= BOOSTTICKS)
+      rqboost(rq);
 
-      swtch(&(c->scheduler), p->context);
+    // Take the next process off the local queues; if they are empty,
+    // steal from another CPU.  An idle CPU therefore spins only on
+    // its own queue lock, never on ptable.lock.
+    if ((p = rqget(rq)) == 0 && (p = rqsteal(c - cpus)) == 0) {
+      // Park on the kernel page table (a no-op after the first idle
+      // pass) so the page table we were left holding can be freed.
       switchkvm();
+      // Nothing to run anywhere: halt until an interrupt arrives
+      // instead of spinning.  Publish the idle flag with a locked op,
+      // then re-check the local queue; rqput() does the mirror-image
+      // append-then-flag-check, so a process queued in the window is
+      // either picked up by the re-check or answered with a wakeup
+      // IPI.  cli() holds any such IPI pending across the re-check,
+      // and the sti;hlt pair's one-instruction interrupt shadow
+      // delivers it only once hlt can be woken by it.
+      cli();
+      xchg(&c->idle, 1);
+      if ((p = rqget(rq)) == 0) {
+        sti();
+        hlt();
+        c->idle = 0;
+        continue;
+      }
+      c->idle = 0;
+      sti();
+    }
 
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+    // A popped process is RUNNABLE but on no queue, so no other CPU
+    // can reach it; only now take ptable.lock for the switch.  If the
+    // process was enqueued by yield() or fork(), its enqueuer held
+    // ptable.lock until after the context was saved, so acquiring it
+    // here also orders us behind that save.
+    acquire(&ptable.lock);
+    if (p->swapping) {
+      // The pager is rewriting this process's page table; running it
+      // now would race the eviction.  Leave it queued for later.
+      rqput(p);
+      release(&ptable.lock);
+      continue;
+    }
+    p->rqcpu = c - cpus;
+    c->proc = p;
+    p->nswitch++;
+    switchuvm(p);
+    p->state = RUNNING;
+
+    swtch(&(c->scheduler), p->context);
+    // The process's page table stays loaded: if the same process is
+    // dispatched next, switchuvm() skips the cr3 reload and its TLB
+    // flush entirely.  The kernel half of every page table is
+    // identical, so running here on the old one is fine; freevm()
+    // defers reusing a directory page any cpu still has loaded.
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+
+    // If the departing process owns the FPU, save its state now so it
+    // can migrate to another CPU, and re-arm the CR0.TS trap.  TS is
+    // still clear (only fputrap clears it, only we set it), so the
+    // fxsave itself cannot trap.
+    if (c->fpuproc) {
+      fxsave(c->fpuproc->fpstate);
+      c->fpuproc = 0;
+      lcr0(rcr0() | CR0_TS);
     }
     release(&ptable.lock);
   }
@@ -355,9 +832,18 @@ void sched(void) {
 }
 
 // Give up the CPU for one scheduling round.
+// A process that keeps exhausting its slice sinks to a lower level;
+// one that sleeps before the slice ends is boosted again in wakeup1.
 void yield(void) {
+  struct proc *p = myproc();
+
   acquire(&ptable.lock); // DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  if (++p->qticks >= QSLICE(p->qlevel)) {
+    p->qticks = 0;
+    if (p->qlevel < NQUEUE - 1)
+      p->qlevel++;
+  }
+  setrunnable(p);
   sched();
   release(&ptable.lock);
 }
@@ -376,6 +862,10 @@ void forkret(void) {
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    freemapinit(ROOTDEV);
+    tmpfsinit();
+    swapinit(ROOTDEV);
+    kzerodinit();
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -405,6 +895,8 @@ void sleep(void *chan, struct spinlock *lk) {
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wnext = wq[WHASH(chan)];
+  wq[WHASH(chan)] = p;
 
   sched();
 
@@ -418,15 +910,40 @@ void sleep(void *chan, struct spinlock *lk) {
   }
 }
 
+// Remove p from its wait-queue bucket.
+// The ptable lock must be held.
+static void wqunlink(struct proc *p) {
+  struct proc **pp;
+
+  for (pp = &wq[WHASH(p->chan)]; *pp; pp = &(*pp)->wnext) {
+    if (*pp == p) {
+      *pp = p->wnext;
+      p->wnext = 0;
+      return;
+    }
+  }
+  panic("wqunlink");
+}
+
 // PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void wakeup1(void *chan) {
-  struct proc *p;
-
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc *p, **pp;
+
+  for (pp = &wq[WHASH(chan)]; (p = *pp) != 0;) {
+    if (p->chan == chan) {
+      *pp = p->wnext;
+      p->wnext = 0;
+      // Waking from a blocking wait marks the process interactive:
+      // put it back on the top-priority queue.
+      p->qlevel = 0;
+      p->qticks = 0;
+      setrunnable(p);
+    } else {
+      pp = &p->wnext;
+    }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -436,6 +953,63 @@ void wakeup(void *chan) {
   release(&ptable.lock);
 }
 
+// Pick a process whose user pages the pager may safely evict: not
+// running, not already being paged, and with its page table loaded in
+// no cpu's cr3 (lazy cr3 switching would otherwise leave stale TLB
+// entries live after a later dispatch).  The victim is marked so the
+// scheduler will not run it until swapdone(); a rotating hand spreads
+// the pain across processes.  Returns 0 if nothing qualifies.
+struct proc *swapvictim(void) {
+  static int hand;
+  struct proc *p;
+  int i;
+
+  acquire(&ptable.lock);
+  for (i = 0; i < NPROC; i++) {
+    p = &ptable.proc[(hand + i) % NPROC];
+    if (p == myproc() || p->swapping || p->pgdir == 0 || p->sz == 0)
+      continue;
+    if (p->state != SLEEPING && p->state != RUNNABLE)
+      continue;
+    if (pgdirinuse(p->pgdir))
+      continue;
+    p->swapping = 1;
+    hand = (hand + i + 1) % NPROC;
+    release(&ptable.lock);
+    return p;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Let a swapvictim() process run again.
+void swapdone(struct proc *p) {
+  acquire(&ptable.lock);
+  p->swapping = 0;
+  release(&ptable.lock);
+}
+
+// Set pid's priority band.  nice runs from -(NQUEUE-1), which pins a
+// latency-critical process to the top queues, to NQUEUE-1, which
+// keeps a background job on the bottom ones; 0 is the default MLFQ
+// behaviour.  Takes effect at the process's next enqueue (rqput).
+int setpriority(int pid, int nice) {
+  struct proc *p;
+
+  if (nice <= -NQUEUE || nice >= NQUEUE)
+    return -1;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    if (p->pid == pid && p->state != UNUSED) {
+      p->nice = nice;
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -447,8 +1021,12 @@ int kill(int pid) {
     if (p->pid == pid) {
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if (p->state == SLEEPING) {
+        wqunlink(p);
+        p->qlevel = 0;
+        p->qticks = 0;
+        setrunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
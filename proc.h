@@ -7,6 +7,10 @@ struct cpu {
   volatile uint started;     // Has the CPU started?
   int ncli;                  // Depth of pushcli nesting.
   int intena;                // Were interrupts enabled before pushcli?
+  pde_t *curpgdir;           // Page table loaded in cr3 (see loadpgdir)
+  int tickmult;              // Current timer stretch factor (trap.c)
+  volatile uint idle;        // Parked in hlt; rqput() sends a wakeup IPI
+  struct proc *fpuproc;      // Process whose FPU state is live here
   struct proc *proc;         // The process running on this cpu or null
 };
 
@@ -34,6 +38,47 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A loadable ELF segment of the running executable, kept so the page
+// fault handler can read program pages in from the inode on demand.
+// A memory-mapped file region, demand-paged by mmapfault().
+// Regions are carved downward from MMAPTOP (see memlayout.h).
+#define NVMA 4
+struct vma {
+  uint addr;        // start virtual address (page aligned); ip==0 if unused
+  uint len;         // length in bytes
+  uint off;         // file offset of the first page
+  struct inode *ip; // mapped file
+};
+
+// One shared memory attachment: segment id mapped at addr.
+// addr == 0 marks a free slot.  See shm.c.
+struct shmatt {
+  uint addr; // attach address (page aligned, in the mmap arena)
+  uint len;  // bytes mapped
+  int id;    // segment id in shm.c's table
+};
+
+#define NELFSEG 4
+struct progseg {
+  uint vaddr;  // start of segment in user memory (page-aligned)
+  uint off;    // offset of segment contents in the executable
+  uint filesz; // bytes backed by the file; rest is zero-fill
+  uint memsz;  // total bytes of the segment in memory
+};
+
+// A loaded executable image, built by loadimage() in exec.c and
+// committed to a process by exec() or spawn().
+struct execimg {
+  pde_t *pgdir;     // fresh address space with argv on the stack
+  uint sz;          // process size
+  uint entry;       // initial eip
+  uint sp;          // initial esp
+  struct inode *exeip; // executable inode, for demand paging
+  int nseg;
+  struct progseg segs[NELFSEG];
+  char name[16];    // basename of the path, for debugging
+};
+
 // Per-process state
 struct proc {
   uint sz;                    // Size of process memory (bytes)
@@ -46,8 +91,33 @@ struct proc {
   struct context *context;    // swtch() here to run process
   void *chan;                 // If non-zero, sleeping on chan
   int killed;                 // If non-zero, have been killed
+  int swapping;               // Pager is evicting our pages; don't run
+  int nice;                   // Priority band: <0 pins to the top MLFQ
+                              // queues, >0 to the bottom (setpriority)
+  int qlevel;                 // MLFQ level; 0 is highest priority
+  int qticks;                 // Ticks consumed at this level
+  int rqcpu;                  // CPU whose run queue holds this process
+  struct proc *qnext;         // Next process on run queue
+  struct proc *wnext;         // Next process on wait-queue bucket
+  struct proc *fnext;         // Next slot on ptable's free list
   struct file *ofile[NOFILE]; // Open files
+  uint fdmap[NOFILE / 32];    // Bit set = fd in use; keeps fdalloc O(1)
   struct inode *cwd;          // Current directory
+  struct inode *exeip;        // Executable inode, for demand paging
+  int nseg;                   // Number of entries in segs
+  struct progseg segs[NELFSEG]; // Program segments of the executable
+  struct vma vmas[NVMA];      // Memory-mapped file regions
+  struct shmatt shms[NSHMATT]; // Attached shared memory segments
+  uint mmaptop;               // Lowest address handed out for mmap
+  struct iokring *ioring;     // Async I/O ring (ioring.c), or 0
+  uint cputicks;              // Timer ticks charged while running
+  uint nswitch;               // Times scheduled onto a cpu
+  uint npgflt;                // Page faults repaired
+  uint rbytes;                // Bytes read through readi()
+  uint wbytes;                // Bytes written through writei()
+  int usedfpu;                // Has touched the FPU/SSE (see fputrap)
+  // fxsave/fxrstor area; the instructions require 16-byte alignment.
+  uchar fpstate[512] __attribute__((aligned(16)));
   char name[16];              // Process name (debugging)
 };
 
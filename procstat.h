@@ -0,0 +1,13 @@
+// Per-process resource counters, as read from the PROCSTAT device.
+// Each read returns a fresh snapshot: one record per in-use process,
+// as many whole records as fit in the buffer.
+struct procstat {
+  int pid;
+  int state;     // enum procstate value (see proc.h)
+  char name[16]; // process name
+  uint cputicks; // timer ticks charged while running
+  uint nswitch;  // times scheduled onto a cpu
+  uint npgflt;   // page faults repaired
+  uint rbytes;   // bytes read through readi()
+  uint wbytes;   // bytes written through writei()
+};
@@ -0,0 +1,111 @@
+// Sampling profiler.  Each local-APIC timer interrupt records what
+// the cpu was executing - (pid, eip, user/kernel) from the trapframe -
+// into a per-cpu ring buffer.  The rings are drained through the
+// PROFILE device, so a user tool can aggregate the samples into a
+// flat profile.  Write '1' to the device to start sampling, '0' to
+// stop and discard whatever is buffered.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "profile.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPROFSAMP 1024 // per-cpu ring entries
+
+struct profring {
+  struct profsample samp[NPROFSAMP];
+  uint head;  // next slot to write; advanced only by this cpu's timer
+  uint tail;  // next slot to read; advanced only by profread()
+  uint drops; // samples lost to a full ring
+};
+
+static struct profring rings[NCPU];
+static struct spinlock proflock; // serializes readers and start/stop
+static int profiling;
+
+// Record a sample on this cpu.  Called from the timer interrupt, so
+// each ring has exactly one producer; publishing head after the
+// sample is written makes the ring safe against a concurrent reader
+// without taking a lock in interrupt context.
+void profsample(struct trapframe *tf) {
+  struct profring *r;
+  struct profsample *s;
+
+  if (!profiling)
+    return;
+  r = &rings[cpuid()];
+  if (r->head - r->tail == NPROFSAMP) {
+    r->drops++;
+    return;
+  }
+  s = &r->samp[r->head % NPROFSAMP];
+  s->pid = myproc() ? myproc()->pid : 0;
+  s->eip = tf->eip;
+  s->user = (tf->cs & 3) == DPL_USER;
+  __sync_synchronize();
+  r->head++;
+}
+
+// Copy out as many whole samples as fit in n bytes, draining the
+// per-cpu rings in turn.  Returns 0 when no samples are buffered.
+static int profread(struct inode *ip, char *dst, int n) {
+  struct profring *r;
+  int i, tot;
+
+  // The drain copies into the user buffer under proflock; resolve
+  // the buffer's pages first (see uprefault), since repairing a
+  // swapped-out or unfaulted page sleeps on disk I/O.
+  if (uprefault(dst, n) < 0)
+    return -1;
+  tot = 0;
+  acquire(&proflock);
+  for (i = 0; i < ncpu; i++) {
+    r = &rings[i];
+    while (n - tot >= sizeof(struct profsample) && r->tail != r->head) {
+      memmove(dst + tot, (char *)&r->samp[r->tail % NPROFSAMP],
+              sizeof(struct profsample));
+      tot += sizeof(struct profsample);
+      r->tail++;
+    }
+  }
+  release(&proflock);
+  return tot;
+}
+
+static int profwrite(struct inode *ip, char *buf, int n) {
+  int i;
+
+  if (n < 1)
+    return -1;
+  acquire(&proflock);
+  if (buf[0] == '1') {
+    profiling = 1;
+  } else {
+    // Stop first so the producers go quiet, then reset the rings.  A
+    // timer interrupt that already passed the profiling check may
+    // still deposit one stale sample; the next drain discards it
+    // along with everything else.
+    profiling = 0;
+    for (i = 0; i < NCPU; i++) {
+      rings[i].head = 0;
+      rings[i].tail = 0;
+      rings[i].drops = 0;
+    }
+  }
+  release(&proflock);
+  return n;
+}
+
+void profinit(void) {
+  initlock(&proflock, "profile");
+  devsw[PROFILE].read = profread;
+  devsw[PROFILE].write = profwrite;
+}
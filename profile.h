@@ -0,0 +1,6 @@
+// One profiler sample, as read from the PROFILE device.
+struct profsample {
+  int pid;  // running process, 0 if the cpu was idle
+  uint eip; // interrupted instruction
+  int user; // 1 if the sample was taken in user mode
+};
@@ -0,0 +1,201 @@
+// Shared memory segments: System V-style shmget/shmat, so cooperating
+// processes can exchange data by reference instead of copying every
+// byte twice through a pipe.
+//
+// A segment is a small set of physical pages owned by a global table;
+// shmat() maps them writable into the caller's mmap arena (above
+// proc->sz, so fork's copy-on-write walk never touches them) and
+// takes a reference on each page.  The page refcounts do the heavy
+// lifting: freevm() at exit or exec drops the attach references, the
+// table's own reference keeps the pages alive in between, and the
+// swap and COW machinery leave multiply-referenced frames alone.
+// Segments persist until reboot, as System V segments do.
+//
+// The futex syscall keys waits on the word's physical address, so a
+// synchronization word placed in a segment works across the attached
+// processes unchanged.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;    // user-chosen identity; 0 marks a free slot
+  int npages; // pages in the segment
+  int nattach;
+  char *pages[SHMMAXPG];
+};
+
+static struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+void shminit(void) { initlock(&shm.lock, "shm"); }
+
+// Find the segment with the given key, creating it with room for
+// size bytes if it does not exist.  Returns the segment id, or -1 on
+// bad arguments, a full table, or exhausted memory.
+int shmget(int key, int size) {
+  struct shmseg *s;
+  int i, free, npages;
+
+  if (key == 0 || size <= 0 || size > SHMMAXPG * PGSIZE)
+    return -1;
+  npages = PGROUNDUP(size) / PGSIZE;
+
+  acquire(&shm.lock);
+  free = -1;
+  for (i = 0; i < NSHM; i++) {
+    if (shm.seg[i].key == key) {
+      if (npages > shm.seg[i].npages) {
+        release(&shm.lock);
+        return -1;
+      }
+      release(&shm.lock);
+      return i;
+    }
+    if (shm.seg[i].key == 0 && free < 0)
+      free = i;
+  }
+  if (free < 0) {
+    release(&shm.lock);
+    return -1;
+  }
+  s = &shm.seg[free];
+  for (i = 0; i < npages; i++) {
+    if ((s->pages[i] = kalloczero()) == 0) {
+      while (--i >= 0)
+        kfree(s->pages[i]);
+      release(&shm.lock);
+      return -1;
+    }
+  }
+  s->key = key;
+  s->npages = npages;
+  s->nattach = 0;
+  release(&shm.lock);
+  return free;
+}
+
+// Map segment id's pages into p at addr and take a reference on each.
+// Caller holds shm.lock.  On a mid-range mappages failure the pages
+// already mapped are unmapped again and their references dropped:
+// shmat does not lower mmaptop on failure, so a later shmat, mmap or
+// iosetup will carve the same range and must not find stale present
+// PTEs there (mappages panics on a remap).
+static int shmmap(struct proc *p, struct shmseg *s, uint addr) {
+  int i;
+
+  for (i = 0; i < s->npages; i++) {
+    if (mappages(p->pgdir, (char *)(addr + i * PGSIZE), PGSIZE,
+                 V2P(s->pages[i]), PTE_W | PTE_U) < 0) {
+      deallocuvm(p->pgdir, addr + i * PGSIZE, addr);
+      return -1;
+    }
+    krefinc(s->pages[i]);
+  }
+  return 0;
+}
+
+// Attach segment id to the calling process.  Returns the mapped
+// address, or 0 on failure.
+void *shmat(int id) {
+  struct proc *curproc = myproc();
+  struct shmseg *s;
+  struct shmatt *att;
+  uint addr;
+  int i;
+
+  acquire(&shm.lock);
+  if (id < 0 || id >= NSHM || shm.seg[id].key == 0) {
+    release(&shm.lock);
+    return 0;
+  }
+  s = &shm.seg[id];
+
+  att = 0;
+  for (i = 0; i < NSHMATT; i++) {
+    if (curproc->shms[i].addr == 0) {
+      att = &curproc->shms[i];
+      break;
+    }
+  }
+  if (att == 0) {
+    release(&shm.lock);
+    return 0;
+  }
+
+  // Carve the attach address downward from the mmap arena, like
+  // sys_mmap does for file mappings.
+  addr = PGROUNDDOWN(curproc->mmaptop - s->npages * PGSIZE);
+  if (shmmap(curproc, s, addr) < 0) {
+    release(&shm.lock);
+    return 0;
+  }
+  curproc->mmaptop = addr;
+  att->addr = addr;
+  att->len = s->npages * PGSIZE;
+  att->id = id;
+  s->nattach++;
+  release(&shm.lock);
+  return (void *)addr;
+}
+
+// Replicate p's attachments into fork child np: same addresses, a
+// fresh reference per page.  Returns -1 if mapping fails; the caller
+// tears the child down and freevm() rebalances the refcounts.
+int shmfork(struct proc *p, struct proc *np) {
+  struct shmatt *att;
+  int i;
+
+  acquire(&shm.lock);
+  for (i = 0; i < NSHMATT; i++) {
+    att = &p->shms[i];
+    if (att->addr == 0)
+      continue;
+    if (shmmap(np, &shm.seg[att->id], att->addr) < 0) {
+      release(&shm.lock);
+      return -1;
+    }
+    np->shms[i] = *att;
+    shm.seg[att->id].nattach++;
+  }
+  release(&shm.lock);
+  return 0;
+}
+
+// Drop p's attachments (exit, or exec discarding the address space).
+// The page references themselves are returned by freevm().
+void shmexit(struct proc *p) {
+  int i;
+
+  acquire(&shm.lock);
+  for (i = 0; i < NSHMATT; i++) {
+    if (p->shms[i].addr) {
+      shm.seg[p->shms[i].id].nattach--;
+      p->shms[i].addr = 0;
+    }
+  }
+  release(&shm.lock);
+}
+
+int sys_shmget(void) {
+  int key, size;
+
+  if (argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int sys_shmat(void) {
+  int id;
+
+  if (argint(0, &id) < 0)
+    return -1;
+  return (int)shmat(id);
+}
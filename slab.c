@@ -0,0 +1,113 @@
+// Slab allocator for small fixed-size kernel objects, layered on
+// kalloc().  A kcache carves whole pages into objects of one size and
+// front-ends them with a per-CPU magazine, so the hot alloc/free paths
+// touch only interrupts-off per-CPU state; a magazine that runs dry
+// refills from a shared depot list (and spills back to it) a batch at
+// a time, amortizing the depot lock the way ksteal() amortizes kmem
+// locks.  Unlike the fixed arrays this replaces, a cache grows on
+// demand: the object count is bounded by memory, not a param.h
+// constant.  Pages are never handed back; a cache's high-water mark
+// is its footprint, which is what a static array cost from boot.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NKCACHE 8 // distinct object caches in the kernel
+#define NMAG 16   // objects per per-CPU magazine
+
+struct kmag {
+  int n;
+  void *obj[NMAG];
+};
+
+struct kcache {
+  struct spinlock lock; // protects the depot list
+  char name[16];
+  int size;    // object size, rounded up to hold the freelist link
+  void *depot; // shared free objects, linked through their first word
+  struct kmag mag[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kcache cache[NKCACHE];
+  int n;
+} ktable;
+
+void slabinit(void) { initlock(&ktable.lock, "kcache"); }
+
+// Create a cache of size-byte objects.  Caches are never destroyed,
+// so a failure to find a slot is a kernel bug, not a runtime error.
+struct kcache *kcachemk(char *name, int size) {
+  struct kcache *c;
+
+  if (size < sizeof(void *) || size > PGSIZE)
+    panic("kcachemk: size");
+  acquire(&ktable.lock);
+  if (ktable.n >= NKCACHE)
+    panic("kcachemk: caches");
+  c = &ktable.cache[ktable.n++];
+  release(&ktable.lock);
+  initlock(&c->lock, name);
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = (size + 3) & ~3;
+  return c;
+}
+
+// Allocate one object; returns 0 when out of memory.  The contents
+// are junk (freed objects come back as-is, fresh pages as kalloc()
+// left them); callers that need zeroes must clear them.
+void *kcachealloc(struct kcache *c) {
+  struct kmag *m;
+  void *o;
+  char *pg, *p;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if (m->n == 0) {
+    // Refill a magazine's worth from the depot, carving a fresh page
+    // into objects first if the depot is dry.
+    acquire(&c->lock);
+    if (c->depot == 0 && (pg = kalloc()) != 0) {
+      for (p = pg; p + c->size <= pg + PGSIZE; p += c->size) {
+        *(void **)p = c->depot;
+        c->depot = p;
+      }
+    }
+    while (m->n < NMAG && c->depot) {
+      o = c->depot;
+      c->depot = *(void **)o;
+      m->obj[m->n++] = o;
+    }
+    release(&c->lock);
+  }
+  o = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return o;
+}
+
+// Free one object back to its cache.
+void kcachefree(struct kcache *c, void *o) {
+  struct kmag *m;
+  void *s;
+  int i;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if (m->n == NMAG) {
+    // Spill half to the depot, so the next few frees stay local too.
+    acquire(&c->lock);
+    for (i = 0; i < NMAG / 2; i++) {
+      s = m->obj[--m->n];
+      *(void **)s = c->depot;
+      c->depot = s;
+    }
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  popcli();
+}
@@ -10,19 +10,44 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 
+// Upper bound on the adaptive spin in acquiresleep().
+#define SLEEPSPIN 1000
+
 void initsleeplock(struct sleeplock *lk, char *name) {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->holder = 0;
   lk->pid = 0;
 }
 
 void acquiresleep(struct sleeplock *lk) {
+  struct proc *holder;
+  int i;
+
   acquire(&lk->lk);
+  if (lk->locked) {
+    // Adaptive spin: buffer and inode locks usually guard critical
+    // sections much shorter than two context switches, so if the
+    // holder is running on another cpu, briefly spin for the release
+    // instead of going straight to sleep.  holder->state is read
+    // without ptable.lock; it is only a hint, and the iteration bound
+    // keeps a stale read from costing more than a failed spin.
+    holder = lk->holder;
+    if (holder && holder->state == RUNNING) {
+      release(&lk->lk);
+      for (i = 0; i < SLEEPSPIN; i++) {
+        if (*(volatile uint *)&lk->locked == 0 || holder->state != RUNNING)
+          break;
+      }
+      acquire(&lk->lk);
+    }
+  }
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
+  lk->holder = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -30,6 +55,7 @@ void acquiresleep(struct sleeplock *lk) {
 void releasesleep(struct sleeplock *lk) {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->holder = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
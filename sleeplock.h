@@ -1,7 +1,9 @@
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;        // Is the lock held?
-  struct spinlock lk; // spinlock protecting this sleep lock
+  uint locked;         // Is the lock held?
+  struct spinlock lk;  // spinlock protecting this sleep lock
+  struct proc *holder; // Process holding lock, for the adaptive spin
+                       // in acquiresleep().
 
   // For debugging:
   char *name; // Name of lock.
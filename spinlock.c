@@ -6,13 +6,29 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "lockstat.h"
 #include "proc.h"
 #include "spinlock.h"
 
+// Registry of the kernel's statically allocated locks, for
+// lockstats().  Locks living in kalloc'd memory (pipes) come and go,
+// so initlock() leaves them out.  All static locks are initialized on
+// the boot cpu before the others start, so no lock guards the table.
+static struct spinlock *reglock[NREGLOCK];
+static int nreglock;
+
 void initlock(struct spinlock *lk, char *name) {
+  extern char end[]; // first address after kernel loaded from ELF file
+
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->serving = 0;
+  lk->nacquire = 0;
+  lk->nspin = 0;
+  lk->holdcyc = 0;
   lk->cpu = 0;
+  if ((char *)lk < end && nreglock < NREGLOCK)
+    reglock[nreglock++] = lk;
 }
 
 // Acquire the lock.
@@ -20,22 +36,31 @@ void initlock(struct spinlock *lk, char *name) {
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
 void acquire(struct spinlock *lk) {
+  uint ticket, spins;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if (holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while (xchg(&lk->locked, 1) != 0)
-    ;
+  // Take a ticket and wait to be served.  The xadd is atomic, so
+  // every waiter gets a distinct ticket, and since serving advances
+  // by one per release the lock is granted in FIFO order.
+  spins = 0;
+  ticket = xadd(&lk->next, 1);
+  while (*(volatile uint *)&lk->serving != ticket)
+    spins++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
   // references happen after the lock is acquired.
   __sync_synchronize();
 
-  // Record info about lock acquisition for debugging.
+  // Record info about lock acquisition for debugging and profiling.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  lk->nacquire++;
+  lk->nspin += spins;
+  lk->tsc0 = rdtsc();
 }
 
 // Release the lock.
@@ -43,6 +68,7 @@ void release(struct spinlock *lk) {
   if (!holding(lk))
     panic("release");
 
+  lk->holdcyc += rdtsc() - lk->tsc0;
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -53,10 +79,10 @@ void release(struct spinlock *lk) {
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m"(lk->locked) :);
+  // Serve the next ticket.  Only the holder stores to serving, so a
+  // plain increment would do, but use a single instruction so the
+  // waiters never observe a half-updated value.
+  asm volatile("incl %0" : "+m"(lk->serving) :);
 
   popcli();
 }
@@ -81,11 +107,32 @@ void getcallerpcs(void *v, uint pcs[]) {
 int holding(struct spinlock *lock) {
   int r;
   pushcli();
-  r = lock->locked && lock->cpu == mycpu();
+  r = lock->next != lock->serving && lock->cpu == mycpu();
   popcli();
   return r;
 }
 
+// Copy the counters of up to max registered locks into buf.
+// Returns the number of entries filled in.
+int lockstats(struct lockstat *buf, int max) {
+  struct spinlock *lk;
+  int i, j;
+
+  if (max > nreglock)
+    max = nreglock;
+  for (i = 0; i < max; i++) {
+    lk = reglock[i];
+    for (j = 0; j < sizeof(buf->name) - 1 && lk->name[j]; j++)
+      buf[i].name[j] = lk->name[j];
+    for (; j < sizeof(buf->name); j++)
+      buf[i].name[j] = 0;
+    buf[i].nacquire = lk->nacquire;
+    buf[i].nspin = lk->nspin;
+    buf[i].holdcyc = lk->holdcyc;
+  }
+  return max;
+}
+
 // Pushcli/popcli are like cli/sti except that they are matched:
 // it takes two popcli to undo two pushcli.  Also, if interrupts
 // are off, then pushcli, popcli leaves them off.
@@ -1,6 +1,16 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock, implemented as a ticket lock: acquire takes
+// the next ticket with an atomic fetch-and-add and spins until it is
+// served, so waiters get the lock in FIFO order.  The lock is held
+// when next != serving; an all-zero lock is unlocked.
 struct spinlock {
-  uint locked; // Is the lock held?
+  uint next;    // Next ticket to hand out.
+  uint serving; // Ticket currently allowed to hold the lock.
+
+  // Contention statistics, read via lockstats():
+  uint nacquire; // Times the lock was acquired.
+  uint nspin;    // Spin iterations spent waiting for it.
+  uint holdcyc;  // Cycles spent holding it (mod 2^32).
+  uint tsc0;     // Cycle counter at the last acquire.
 
   // For debugging:
   char *name;      // Name of lock.
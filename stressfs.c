@@ -1,11 +1,16 @@
-// Demonstrate that moving the "acquire" in iderw after the loop that
-// appends to the idequeue results in a race.
-
-// For this to work, you should also add a spin within iderw's
-// idequeue traversal loop.  Adding the following demonstrated a panic
-// after about 5 runs of stressfs in QEMU on a 2.1GHz CPU:
-//    for (i = 0; i < 40000; i++)
-//      asm volatile("");
+// Configurable multi-process filesystem benchmark.  Grew out of the
+// old fixed stress test (4 processes, 20 x 512-byte writes each);
+// that workload is still the default, but the process count, file
+// count and size, record size, operation mix, and iteration count
+// are all flags now, and every worker reports throughput and
+// worst-case latency so log/bcache/balloc changes can be compared:
+//
+//   stressfs [-p procs] [-f files] [-s filesize] [-r recsize]
+//            [-i iters] [-R read%] [-W write%] [-C create%] [-U unlink%]
+//
+// The mix weights are relative, not required to sum to 100.  Workers
+// publish their counters through a shared memory segment; the parent
+// aggregates after waiting for them.
 
 #include "types.h"
 #include "stat.h"
@@ -13,35 +18,207 @@
 #include "fs.h"
 #include "fcntl.h"
 
-int main(int argc, char *argv[]) {
-  int fd, i;
-  char path[] = "stressfs0";
-  char data[512];
+#define MAXREC 4096
+#define MAXFILES 8
+#define MAXTMP 8
+
+struct wstat {
+  uint ops;
+  uint cycles;
+  uint maxlat; // slowest single op, cycles
+  uint bytes;
+  uint ticks;
+};
+
+static char buf[MAXREC];
+
+// Low 32 bits of the cycle counter; see perftest.c for why 64-bit
+// math is avoided in user programs.
+static uint rdtsc(void) {
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return lo;
+}
+
+static uint randseed;
+
+static uint rnd(void) {
+  randseed = randseed * 1664525 + 1013904223;
+  return randseed;
+}
+
+// Build "sf<id>.<c><k>" in name; c tags the namespace ('d' for data
+// files, 't' for create/unlink churn).
+static void mkname(char *name, int id, char c, int k) {
+  char *p = name;
+
+  *p++ = 's';
+  *p++ = 'f';
+  if (id >= 10)
+    *p++ = '0' + id / 10;
+  *p++ = '0' + id % 10;
+  *p++ = '.';
+  *p++ = c;
+  *p++ = '0' + k;
+  *p = 0;
+}
+
+static void worker(int id, struct wstat *st, int nfiles, int filesize,
+                   int recsize, int iters, int wr, int ww, int wc, int wu) {
+  char name[DIRSIZ];
+  int fd[MAXFILES], tmp[MAXTMP];
+  int i, j, f, op, pick, total, u0;
+  uint c0, d, off, nrec;
 
-  printf(1, "stressfs starting\n");
-  memset(data, 'a', sizeof(data));
+  randseed = id * 2654435761u + 1;
+  nrec = filesize / recsize;
+  if (nrec == 0)
+    nrec = 1;
+  memset(buf, 'a' + id % 26, recsize);
+  memset(tmp, 0, sizeof(tmp));
 
-  for (i = 0; i < 4; i++)
-    if (fork() > 0)
+  // Lay out this worker's data files before timing starts.
+  for (j = 0; j < nfiles; j++) {
+    mkname(name, id, 'd', j);
+    if ((fd[j] = open(name, O_CREATE | O_RDWR)) < 0) {
+      printf(2, "stressfs: create %s failed\n", name);
+      exit();
+    }
+    for (i = 0; i < nrec; i++)
+      write(fd[j], buf, recsize);
+  }
+
+  total = wr + ww + wc + wu;
+  u0 = uptime();
+  for (i = 0; i < iters; i++) {
+    f = rnd() % nfiles;
+    off = (rnd() % nrec) * recsize;
+    pick = rnd() % total;
+    if (pick < wr)
+      op = 0;
+    else if (pick < wr + ww)
+      op = 1;
+    else if (pick < wr + ww + wc)
+      op = 2;
+    else
+      op = 3;
+
+    c0 = rdtsc();
+    switch (op) {
+    case 0:
+      if (pread(fd[f], buf, recsize, off) == recsize)
+        st->bytes += recsize;
+      break;
+    case 1:
+      if (pwrite(fd[f], buf, recsize, off) == recsize)
+        st->bytes += recsize;
+      break;
+    case 2:
+      j = rnd() % MAXTMP;
+      mkname(name, id, 't', j);
+      if ((f = open(name, O_CREATE | O_RDWR)) >= 0) {
+        close(f);
+        tmp[j] = 1;
+      }
       break;
+    case 3:
+      for (j = 0; j < MAXTMP && !tmp[j]; j++)
+        ;
+      if (j < MAXTMP) {
+        mkname(name, id, 't', j);
+        unlink(name);
+        tmp[j] = 0;
+      }
+      break;
+    }
+    d = rdtsc() - c0;
+    st->cycles += d;
+    if (d > st->maxlat)
+      st->maxlat = d;
+    st->ops++;
+  }
+  st->ticks = uptime() - u0;
+
+  for (j = 0; j < nfiles; j++) {
+    close(fd[j]);
+    mkname(name, id, 'd', j);
+    unlink(name);
+  }
+  for (j = 0; j < MAXTMP; j++) {
+    if (tmp[j]) {
+      mkname(name, id, 't', j);
+      unlink(name);
+    }
+  }
+  exit();
+}
+
+static int flagval(int argc, char *argv[], char *flag, int def) {
+  int i;
+
+  for (i = 1; i + 1 < argc; i++)
+    if (strcmp(argv[i], flag) == 0)
+      return atoi(argv[i + 1]);
+  return def;
+}
+
+int main(int argc, char *argv[]) {
+  struct wstat *st;
+  int nproc, nfiles, filesize, recsize, iters, wr, ww, wc, wu;
+  int i, id, u0, shmid;
+  uint ops, bytes, maxlat;
 
-  printf(1, "write %d\n", i);
+  nproc = flagval(argc, argv, "-p", 4);
+  nfiles = flagval(argc, argv, "-f", 1);
+  filesize = flagval(argc, argv, "-s", 20 * 512);
+  recsize = flagval(argc, argv, "-r", 512);
+  iters = flagval(argc, argv, "-i", 40);
+  wr = flagval(argc, argv, "-R", 50);
+  ww = flagval(argc, argv, "-W", 50);
+  wc = flagval(argc, argv, "-C", 0);
+  wu = flagval(argc, argv, "-U", 0);
 
-  path[8] += i;
-  fd = open(path, O_CREATE | O_RDWR);
-  for (i = 0; i < 20; i++)
-    //    printf(fd, "%d\n", i);
-    write(fd, data, sizeof(data));
-  close(fd);
+  if (nproc < 1 || nfiles < 1 || nfiles > MAXFILES || recsize < 1 ||
+      recsize > MAXREC || filesize < recsize || iters < 1 ||
+      wr + ww + wc + wu < 1) {
+    printf(2, "stressfs: bad parameters\n");
+    exit();
+  }
 
-  printf(1, "read\n");
+  if ((shmid = shmget(0x5f5, nproc * sizeof(struct wstat))) < 0 ||
+      (st = shmat(shmid)) == 0) {
+    printf(2, "stressfs: shm failed\n");
+    exit();
+  }
+  memset(st, 0, nproc * sizeof(struct wstat));
 
-  fd = open(path, O_RDONLY);
-  for (i = 0; i < 20; i++)
-    read(fd, data, sizeof(data));
-  close(fd);
+  printf(1, "stressfs: %d procs, %d files x %d bytes, %d-byte records, "
+            "%d iters, mix R%d/W%d/C%d/U%d\n",
+         nproc, nfiles, filesize, recsize, iters, wr, ww, wc, wu);
 
-  wait();
+  u0 = uptime();
+  for (id = 0; id < nproc; id++) {
+    if (fork() == 0)
+      worker(id, &st[id], nfiles, filesize, recsize, iters, wr, ww, wc, wu);
+  }
+  for (id = 0; id < nproc; id++)
+    wait();
+  u0 = uptime() - u0;
 
+  ops = bytes = maxlat = 0;
+  for (i = 0; i < nproc; i++) {
+    printf(1, "worker %d: %d ops, %d cycles/op, maxlat %d, %d bytes, "
+              "%d ticks\n",
+           i, st[i].ops, st[i].ops ? st[i].cycles / st[i].ops : 0,
+           st[i].maxlat, st[i].bytes, st[i].ticks);
+    ops += st[i].ops;
+    bytes += st[i].bytes;
+    if (st[i].maxlat > maxlat)
+      maxlat = st[i].maxlat;
+  }
+  printf(1, "total: %d ops, %d bytes in %d ticks (%d bytes/tick), "
+            "maxlat %d cycles\n",
+         ops, bytes, u0, u0 ? bytes / u0 : bytes, maxlat);
   exit();
 }
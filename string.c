@@ -2,11 +2,23 @@
 #include "x86.h"
 
 void *memset(void *dst, int c, uint n) {
-  if ((int)dst % 4 == 0 && n % 4 == 0) {
-    c &= 0xFF;
-    stosl(dst, (c << 24) | (c << 16) | (c << 8) | c, n / 4);
-  } else
-    stosb(dst, c, n);
+  char *d = dst;
+  uint head;
+
+  c &= 0xFF;
+
+  // Store bytes until d is 4-aligned, then words, then the tail;
+  // small fills are not worth the alignment dance.
+  if (n >= 8) {
+    head = -(uint)d % 4;
+    stosb(d, c, head);
+    d += head;
+    n -= head;
+    stosl(d, (c << 24) | (c << 16) | (c << 8) | c, n / 4);
+    d += n - n % 4;
+    n %= 4;
+  }
+  stosb(d, c, n);
   return dst;
 }
 
@@ -27,17 +39,33 @@ int memcmp(const void *v1, const void *v2, uint n) {
 void *memmove(void *dst, const void *src, uint n) {
   const char *s;
   char *d;
+  uint head;
 
   s = src;
   d = dst;
   if (s < d && s + n > d) {
+    // Overlapping with dst above src: must copy backwards.  Rare
+    // (argv shuffling), so the byte loop stays.
     s += n;
     d += n;
     while (n-- > 0)
       *--d = *--s;
-  } else
-    while (n-- > 0)
-      *d++ = *s++;
+  } else if (((uint)d - (uint)s) % 4 == 0 && n >= 8) {
+    // Copy bytes until both pointers are 4-aligned, then words,
+    // then the tail.  This path is under every page copy and every
+    // bcache transfer, where n is large and aligned.
+    head = -(uint)d % 4;
+    movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    movsl(d, s, n / 4);
+    d += n - n % 4;
+    s += n - n % 4;
+    movsb(d, s, n % 4);
+  } else {
+    movsb(d, s, n);
+  }
 
   return dst;
 }
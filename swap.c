@@ -0,0 +1,114 @@
+// Swap: disk-backed overflow for user pages, so memory overcommit
+// degrades into paging instead of failed forks and sbrks.
+//
+// mkfs lays out a swap region after the filesystem proper and
+// describes it in the superblock; this file manages the region as an
+// array of page-sized slots.  When kalloc() runs dry, swapout() picks
+// a victim process (proc.c), evicts its least recently used pages
+// (vm.c) into free slots, and swapfault() reads a page back in when
+// the owner touches it again.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define SPP (PGSIZE / BSIZE) // disk blocks per swap slot
+#define SWAPBATCH 16         // pages evicted per swapout() call
+
+static struct {
+  struct spinlock lock;
+  int dev;
+  uint start;  // first disk block of the swap region
+  uint nslots; // page-sized slots in the region; 0 disables swap
+  uint hint;   // rotating search start for the next free slot
+  uchar map[NSWAPPAGES / 8]; // in-use bitmap, one bit per slot
+} swap;
+
+// Read the swap region geometry from the superblock.  Images built
+// without a swap region leave the fields zero and swapping stays off.
+// Called once, from a process context (readsb sleeps).
+void swapinit(int dev) {
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  readsb(dev, &sb);
+  if (sb.nswap == 0)
+    return;
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslots = sb.nswap / SPP;
+  if (swap.nslots > NSWAPPAGES)
+    swap.nslots = NSWAPPAGES;
+  cprintf("swap: %d pages at block %d\n", swap.nslots, swap.start);
+}
+
+// Allocate a free swap slot.  Returns -1 if swap is full or absent.
+int swapalloc(void) {
+  uint i, s;
+
+  acquire(&swap.lock);
+  for (i = 0; i < swap.nslots; i++) {
+    s = (swap.hint + i) % swap.nslots;
+    if ((swap.map[s / 8] & (1 << (s % 8))) == 0) {
+      swap.map[s / 8] |= 1 << (s % 8);
+      swap.hint = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+void swapfree(int slot) {
+  acquire(&swap.lock);
+  if ((swap.map[slot / 8] & (1 << (slot % 8))) == 0)
+    panic("swapfree");
+  swap.map[slot / 8] &= ~(1 << (slot % 8));
+  release(&swap.lock);
+}
+
+// Copy one page between the frame at kernel address pa and slot.
+// Swap I/O bypasses the log: slots live outside the filesystem and a
+// lost write costs nothing after a crash.
+static void swaprw(int slot, char *pa, int write) {
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < SPP; i++) {
+    b = bread(swap.dev, swap.start + slot * SPP + i);
+    if (write) {
+      memmove(b->data, pa + i * BSIZE, BSIZE);
+      bwrite(b);
+    } else
+      memmove(pa + i * BSIZE, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+void swapread(int slot, char *pa) { swaprw(slot, pa, 0); }
+
+void swapwrite(int slot, char *pa) { swaprw(slot, pa, 1); }
+
+// Reclaim memory by paging out a batch of one victim process's least
+// recently used pages.  Returns the number of pages freed; callers
+// retry their kalloc() on a positive return.
+int swapout(void) {
+  struct proc *p;
+  int n;
+
+  if (swap.nslots == 0)
+    return 0;
+  if ((p = swapvictim()) == 0)
+    return 0;
+  n = swapoutproc(p, SWAPBATCH);
+  swapdone(p);
+  return n;
+}
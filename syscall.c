@@ -46,16 +46,41 @@ int argint(int n, int *ip) {
   return fetchint((myproc()->tf->esp) + 4 + 4 * n, ip);
 }
 
+// Is [addr, addr+size) a valid user buffer?  Valid means below the
+// program break, inside a memory-mapped file region, or inside an
+// attached shared memory segment.
+int uaddrok(uint addr, uint size) {
+  struct proc *curproc = myproc();
+  struct shmatt *a;
+  struct vma *v;
+  int i;
+
+  if (addr + size < addr)
+    return 0;
+  if (addr < curproc->sz && addr + size <= curproc->sz)
+    return 1;
+  for (i = 0; i < NVMA; i++) {
+    v = &curproc->vmas[i];
+    if (v->ip && addr >= v->addr && addr + size <= v->addr + v->len)
+      return 1;
+  }
+  for (i = 0; i < NSHMATT; i++) {
+    a = &curproc->shms[i];
+    if (a->addr && addr >= a->addr && addr + size <= a->addr + a->len)
+      return 1;
+  }
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
 // lies within the process address space.
 int argptr(int n, char **pp, int size) {
   int i;
-  struct proc *curproc = myproc();
 
   if (argint(n, &i) < 0)
     return -1;
-  if (size < 0 || (uint)i >= curproc->sz || (uint)i + size > curproc->sz)
+  if (size < 0 || !uaddrok(i, size))
     return -1;
   *pp = (char *)i;
   return 0;
@@ -81,22 +106,40 @@ extern int sys_dup(void);
 extern int sys_exec(void);
 extern int sys_exit(void);
 extern int sys_fork(void);
+extern int sys_fsstats(void);
 extern int sys_fstat(void);
+extern int sys_futex(void);
+extern int sys_getdents(void);
 extern int sys_getpid(void);
+extern int sys_hrtime(void);
+extern int sys_ioenter(void);
+extern int sys_iosetup(void);
+extern int sys_memwait(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
 extern int sys_kill(void);
 extern int sys_link(void);
 extern int sys_listen(void);
+extern int sys_lockstats(void);
 extern int sys_mkdir(void);
+extern int sys_mmap(void);
 extern int sys_mknod(void);
 extern int sys_open(void);
 extern int sys_pipe(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
 extern int sys_read(void);
 extern int sys_recv(void);
 extern int sys_sbrk(void);
 extern int sys_send(void);
+extern int sys_setpriority(void);
+extern int sys_shmat(void);
+extern int sys_shmget(void);
 extern int sys_shutdown(void);
 extern int sys_sleep(void);
 extern int sys_socket(void);
+extern int sys_spawn(void);
+extern int sys_splice(void);
 extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
@@ -119,6 +162,18 @@ static int (*syscalls[])(void) = {
     [SYS_listen] sys_listen, [SYS_connect] sys_connect,
     [SYS_accept] sys_accept, [SYS_send] sys_send,
     [SYS_recv] sys_recv,     [SYS_shutdown] sys_shutdown,
+
+    [SYS_splice] sys_splice, [SYS_futex] sys_futex,
+    [SYS_mmap] sys_mmap,     [SYS_pread] sys_pread,
+    [SYS_pwrite] sys_pwrite, [SYS_lockstats] sys_lockstats,
+    [SYS_hrtime] sys_hrtime, [SYS_shmget] sys_shmget,
+    [SYS_shmat] sys_shmat,   [SYS_spawn] sys_spawn,
+
+    [SYS_fsstats] sys_fsstats, [SYS_getdents] sys_getdents,
+    [SYS_setpriority] sys_setpriority,
+    [SYS_iosetup] sys_iosetup, [SYS_ioenter] sys_ioenter,
+    [SYS_memwait] sys_memwait,   [SYS_readv] sys_readv,
+    [SYS_writev] sys_writev,
 };
 
 void syscall(void) {
@@ -28,3 +28,21 @@
 #define SYS_send 31
 #define SYS_recv 32
 #define SYS_shutdown 33
+#define SYS_splice 34
+#define SYS_futex 35
+#define SYS_mmap 36
+#define SYS_pread 37
+#define SYS_pwrite 38
+#define SYS_lockstats 39
+#define SYS_hrtime 40
+#define SYS_shmget 41
+#define SYS_shmat 42
+#define SYS_spawn 43
+#define SYS_fsstats 44
+#define SYS_getdents 45
+#define SYS_setpriority 46
+#define SYS_iosetup 47
+#define SYS_ioenter 48
+#define SYS_memwait 49
+#define SYS_readv 50
+#define SYS_writev 51
@@ -8,6 +8,7 @@
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
+#include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
@@ -15,6 +16,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "fsstat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -35,12 +37,19 @@ static int argfd(int n, int *pfd, struct file **pf) {
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
+// The in-use bitmap makes this independent of NOFILE: find a word
+// with a clear bit, then the lowest clear bit in it, so the lowest
+// free descriptor is still returned.
 static int fdalloc(struct file *f) {
-  int fd;
   struct proc *curproc = myproc();
-
-  for (fd = 0; fd < NOFILE; fd++) {
-    if (curproc->ofile[fd] == 0) {
+  int w, b, fd;
+
+  for (w = 0; w < NOFILE / 32; w++) {
+    if (curproc->fdmap[w] != 0xffffffff) {
+      for (b = 0; curproc->fdmap[w] & (1u << b); b++)
+        ;
+      fd = w * 32 + b;
+      curproc->fdmap[w] |= 1u << b;
       curproc->ofile[fd] = f;
       return fd;
     }
@@ -48,6 +57,14 @@ static int fdalloc(struct file *f) {
   return -1;
 }
 
+// Release a descriptor (but not the file reference it held).
+static void fdfree(int fd) {
+  struct proc *curproc = myproc();
+
+  curproc->ofile[fd] = 0;
+  curproc->fdmap[fd / 32] &= ~(1u << (fd % 32));
+}
+
 int sys_dup(void) {
   struct file *f;
   int fd;
@@ -70,6 +87,35 @@ int sys_read(void) {
   return fileread(f, p, n);
 }
 
+// pread(fd, buf, n, off): positional read that leaves the shared
+// file offset untouched.
+int sys_pread(void) {
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0 ||
+      argptr(1, &p, n) < 0)
+    return -1;
+  if (off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+// pwrite(fd, buf, n, off): positional write.
+int sys_pwrite(void) {
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0 ||
+      argptr(1, &p, n) < 0)
+    return -1;
+  if (off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
 int sys_write(void) {
   struct file *f;
   int n;
@@ -80,17 +126,170 @@ int sys_write(void) {
   return filewrite(f, p, n);
 }
 
+// Validate a writev/readv iovec array: every segment must be a legal
+// user range and the lengths must not overflow.  Returns the total
+// byte count through *ptot, or -1.
+static int argiov(struct iovec *iov, int n, uint *ptot) {
+  uint tot;
+  int i;
+
+  tot = 0;
+  for (i = 0; i < n; i++) {
+    if (!uaddrok((uint)iov[i].base, iov[i].len) || tot + iov[i].len < tot)
+      return -1;
+    tot += iov[i].len;
+  }
+  *ptot = tot;
+  return 0;
+}
+
+// writev(fd, iov, n): gather up to NIOV segments through a kernel
+// page and write them as one stream.  A header + payload pair framed
+// this way costs one trap and, below a page, one filewrite() — one
+// log transaction on a file, one wakeup round on a pipe — where two
+// write() calls paid two of each.
+int sys_writev(void) {
+  struct file *f;
+  struct iovec *iov;
+  char *pg;
+  uint tot, fill, soff, m;
+  int i, n, r, done;
+
+  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 || n > NIOV ||
+      argptr(1, (char **)&iov, n * sizeof(*iov)) < 0 ||
+      argiov(iov, n, &tot) < 0)
+    return -1;
+  if ((pg = kalloc()) == 0)
+    return -1;
+  done = 0;
+  i = 0;
+  soff = 0;
+  for (;;) {
+    fill = 0;
+    while (i < n && fill < PGSIZE) {
+      m = iov[i].len - soff;
+      if (m > PGSIZE - fill)
+        m = PGSIZE - fill;
+      memmove(pg + fill, (char *)iov[i].base + soff, m);
+      fill += m;
+      soff += m;
+      if (soff == iov[i].len) {
+        i++;
+        soff = 0;
+      }
+    }
+    if (fill == 0)
+      break;
+    r = filewrite(f, pg, fill);
+    if (r > 0)
+      done += r;
+    if (r < (int)fill) { // error or partial write; report what landed
+      if (done == 0)
+        done = -1;
+      break;
+    }
+  }
+  kfree(pg);
+  return done;
+}
+
+// readv(fd, iov, n): read one stream and scatter it across up to
+// NIOV segments, through a kernel page like writev above.
+int sys_readv(void) {
+  struct file *f;
+  struct iovec *iov;
+  char *pg;
+  uint tot, want, soff, off, m;
+  int i, n, r, done;
+
+  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 || n > NIOV ||
+      argptr(1, (char **)&iov, n * sizeof(*iov)) < 0 ||
+      argiov(iov, n, &tot) < 0)
+    return -1;
+  if ((pg = kalloc()) == 0)
+    return -1;
+  done = 0;
+  i = 0;
+  soff = 0;
+  while ((uint)done < tot) {
+    want = tot - done;
+    if (want > PGSIZE)
+      want = PGSIZE;
+    r = fileread(f, pg, want);
+    if (r < 0 && done == 0)
+      done = -1;
+    if (r <= 0)
+      break;
+    for (off = 0; off < (uint)r;) {
+      m = iov[i].len - soff;
+      if (m > (uint)r - off)
+        m = (uint)r - off;
+      memmove((char *)iov[i].base + soff, pg + off, m);
+      off += m;
+      soff += m;
+      if (soff == iov[i].len) {
+        i++;
+        soff = 0;
+      }
+    }
+    done += r;
+    if ((uint)r < want) // end of file or short pipe read
+      break;
+  }
+  kfree(pg);
+  return done;
+}
+
 int sys_close(void) {
   int fd;
   struct file *f;
 
   if (argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdfree(fd);
   fileclose(f);
   return 0;
 }
 
+// getdents(fd, buf, n): fill buf with struct dent records (fs.h) for
+// the open directory fd, advancing its offset.  Each record carries
+// the entry's type and size, read from the inode blocks under the
+// directory lock, so a listing costs one syscall per batch instead
+// of a stat (a full path resolution) per name.  Returns the number
+// of bytes filled; 0 at end of directory.
+int sys_getdents(void) {
+  struct file *f;
+  struct dirent de;
+  struct dent d;
+  char *buf;
+  int n, got;
+
+  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &buf, n) < 0)
+    return -1;
+  if (f->type != FD_INODE || f->readable == 0)
+    return -1;
+  ilock(f->ip);
+  if (f->ip->type != T_DIR) {
+    iunlock(f->ip);
+    return -1;
+  }
+  got = 0;
+  while (got + sizeof(d) <= (uint)n) {
+    if (readi(f->ip, (char *)&de, f->off, sizeof(de)) != sizeof(de))
+      break;
+    f->off += sizeof(de);
+    if (de.inum == 0)
+      continue;
+    d.inum = de.inum;
+    dirstat(f->ip->dev, de.inum, &d.type, &d.size);
+    memmove(d.name, de.name, DIRSIZ);
+    memmove(buf + got, &d, sizeof(d));
+    got += sizeof(d);
+  }
+  iunlock(f->ip);
+  return got;
+}
+
 int sys_fstat(void) {
   struct file *f;
   struct stat *st;
@@ -163,6 +362,184 @@ static int isdirempty(struct inode *dp) {
 }
 
 // PAGEBREAK!
+// Shared cache of assembled file pages, keyed (dev, inum, byte
+// offset).  Page-aligned file pages are one 4KB block and are mapped
+// straight out of the buffer cache (readpage); this table serves the
+// remaining case, exec of binaries whose ELF segment offsets are not
+// page-aligned, where a page straddles two blocks and must be
+// assembled by copying once.  The cache holds one page reference per
+// entry and each mapper holds its own; kfree() frees a frame only
+// when the last reference drops, so evicting an entry (round-robin
+// on overflow) merely forgets the frame while existing mappings keep
+// it alive.
+#define NMPAGE 64
+static struct {
+  struct spinlock lock;
+  uint victim;
+  struct {
+    uint dev, inum, off;
+    char *page;
+  } pg[NMPAGE];
+} mcache;
+
+void mmapinit(void) { initlock(&mcache.lock, "mcache"); }
+
+// Caller must hold mcache.lock.
+static char *mlookup(uint dev, uint inum, uint off) {
+  int i;
+
+  for (i = 0; i < NMPAGE; i++) {
+    if (mcache.pg[i].page && mcache.pg[i].dev == dev &&
+        mcache.pg[i].inum == inum && mcache.pg[i].off == off)
+      return mcache.pg[i].page;
+  }
+  return 0;
+}
+
+// Take a reference to the cached frame holding (dev, inum)'s page at
+// byte offset off, or return 0 if it is not cached.
+char *mpageget(uint dev, uint inum, uint off) {
+  char *mem;
+
+  acquire(&mcache.lock);
+  if ((mem = mlookup(dev, inum, off)) != 0)
+    krefinc(mem);
+  release(&mcache.lock);
+  return mem;
+}
+
+// Offer a freshly filled frame for (dev, inum, off) to the cache.  If
+// another process cached the same page meanwhile, the offered frame
+// is freed and the cached one returned instead; either way the caller
+// ends up holding one reference to the returned frame.
+char *mpageput(uint dev, uint inum, uint off, char *mem) {
+  char *other;
+  int i;
+
+  acquire(&mcache.lock);
+  if ((other = mlookup(dev, inum, off)) != 0) {
+    kfree(mem);
+    mem = other;
+    krefinc(mem);
+  } else {
+    i = mcache.victim++ % NMPAGE;
+    if (mcache.pg[i].page)
+      kfree(mcache.pg[i].page); // drop the cache's reference
+    mcache.pg[i].dev = dev;
+    mcache.pg[i].inum = inum;
+    mcache.pg[i].off = off;
+    mcache.pg[i].page = mem;
+    krefinc(mem);
+  }
+  release(&mcache.lock);
+  return mem;
+}
+
+// mmap(fd, off, len): map len bytes of fd, starting at page-aligned
+// file offset off, read-only into the address space.  Pages fault in
+// on demand and are shared between processes mapping the same file.
+// There is no write-back: mappings are for reading, and stores to
+// one fault.  Returns the mapped address, or -1.
+int sys_mmap(void) {
+  struct file *f;
+  struct proc *curproc = myproc();
+  struct vma *v;
+  int off, len, i;
+
+  if (argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if (f->type != FD_INODE || f->readable == 0)
+    return -1;
+  if (len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+
+  v = 0;
+  for (i = 0; i < NVMA; i++) {
+    if (curproc->vmas[i].ip == 0) {
+      v = &curproc->vmas[i];
+      break;
+    }
+  }
+  if (v == 0)
+    return -1;
+
+  v->addr = PGROUNDDOWN(curproc->mmaptop - len);
+  if (v->addr <= curproc->sz) // would run into the heap
+    return -1;
+  curproc->mmaptop = v->addr;
+  v->len = len;
+  v->off = off;
+  v->ip = idup(f->ip);
+  return v->addr;
+}
+
+// Demand-page one mapped file page at va.  Returns 0 on success, -1
+// if va is in no mapping or memory is exhausted.
+int mmapfault(struct proc *p, uint va) {
+  struct vma *v;
+  char *mem;
+  uint pva, foff;
+  int i, locked;
+
+  v = 0;
+  for (i = 0; i < NVMA; i++) {
+    if (p->vmas[i].ip && va >= p->vmas[i].addr &&
+        va < p->vmas[i].addr + p->vmas[i].len) {
+      v = &p->vmas[i];
+      break;
+    }
+  }
+  if (v == 0)
+    return -1;
+
+  // A present PTE means this was a protection fault — a store to the
+  // read-only mapping — not a missing page; remapping it would panic
+  // in mappages().  Writes are not allowed here, so fail and let the
+  // faulting process be killed.
+  if (uvamapped(p->pgdir, va))
+    return -1;
+
+  pva = PGROUNDDOWN(va);
+  foff = v->off + (pva - v->addr);
+
+  // mmap offsets are page-aligned and BSIZE == PGSIZE, so the page is
+  // exactly one file block: map the bcache frame itself (zero-copy,
+  // and coherent with writes through the file).  Past EOF the page is
+  // a private zero fill.  The fault may arrive while this process
+  // already holds the inode lock (e.g. reading the file into its own
+  // mapping).
+  locked = !holdingsleep(&v->ip->lock);
+  if (locked)
+    ilock(v->ip);
+  mem = readpage(v->ip, foff);
+  if (locked)
+    iunlock(v->ip);
+  if (mem == 0 && (mem = kalloczero()) == 0)
+    return -1;
+
+  if (mappages(p->pgdir, (char *)pva, PGSIZE, V2P(mem), PTE_U) < 0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Move up to n bytes from a pipe read fd straight into a file fd,
+// skipping the round trip through a user buffer.
+// splice(fdin, fdout, n)
+int sys_splice(void) {
+  struct file *fin, *fout;
+  int n;
+
+  if (argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  if (n < 0 || fin->type != FD_PIPE || fin->readable == 0)
+    return -1;
+  if (fout->type != FD_INODE || fout->writable == 0)
+    return -1;
+  return pipesplice(fin->pipe, fout, n);
+}
+
 int sys_unlink(void) {
   struct inode *ip, *dp;
   struct dirent de;
@@ -186,6 +563,11 @@ int sys_unlink(void) {
 
   if ((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  if (off == (uint)-1) {
+    // Mount-point crossing: the name has no dirent to rewrite.
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if (ip->nlink < 1)
@@ -198,6 +580,7 @@ int sys_unlink(void) {
   memset(&de, 0, sizeof(de));
   if (writei(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dirunlink(dp, name, off);
   if (ip->type == T_DIR) {
     dp->nlink--;
     iupdate(dp);
@@ -235,10 +618,13 @@ static struct inode *create(char *path, short type, short major, short minor) {
     return 0;
   }
 
-  if ((ip = ialloc(dp->dev, type)) == 0)
+  // Allocate near the parent so a directory's files share inode
+  // blocks and, via agoal, a data region.
+  if ((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
+  ip->agoal = dp->agoal ? dp->agoal : dp->addrs[0];
   ip->major = major;
   ip->minor = minor;
   ip->nlink = 1;
@@ -305,6 +691,8 @@ int sys_open(void) {
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  // Only disk files have a cache to bypass; tmpfs and devices don't.
+  f->direct = (omode & O_DIRECT) && ip->type == T_FILE && ip->dev != TMPDEV;
   return fd;
 }
 
@@ -385,6 +773,32 @@ int sys_exec(void) {
   return exec(path, argv);
 }
 
+// Same argument convention as exec, but runs the program in a new
+// child process instead of replacing this one.
+int sys_spawn(void) {
+  char *path, *argv[MAXARG];
+  int i;
+  uint uargv, uarg;
+
+  if (argstr(0, &path) < 0 || argint(1, (int *)&uargv) < 0) {
+    return -1;
+  }
+  memset(argv, 0, sizeof(argv));
+  for (i = 0;; i++) {
+    if (i >= NELEM(argv))
+      return -1;
+    if (fetchint(uargv + 4 * i, (int *)&uarg) < 0)
+      return -1;
+    if (uarg == 0) {
+      argv[i] = 0;
+      break;
+    }
+    if (fetchstr(uarg, &argv[i]) < 0)
+      return -1;
+  }
+  return spawn(path, argv);
+}
+
 int sys_pipe(void) {
   int *fd;
   struct file *rf, *wf;
@@ -397,7 +811,7 @@ int sys_pipe(void) {
   fd0 = -1;
   if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
     if (fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -406,3 +820,14 @@ int sys_pipe(void) {
   fd[1] = fd1;
   return 0;
 }
+
+// fsstats(buf): copy the bcache/icache/log counters out, in the
+// same spirit as lockstats().
+int sys_fsstats(void) {
+  char *buf;
+
+  if (argptr(0, &buf, sizeof(struct fsstat)) < 0)
+    return -1;
+  *(struct fsstat *)buf = fsstat;
+  return 0;
+}
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "lockstat.h"
 
 int sys_fork(void) { return fork(); }
 
@@ -40,30 +42,125 @@ int sys_sbrk(void) {
 
 int sys_sleep(void) {
   int n;
-  uint ticks0;
+  uint deadline;
 
   if (argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n) {
+  deadline = ticks + n;
+  // Park on the timer-wheel slot for our deadline; only the slot
+  // that expires each tick gets woken.  tickslock stays: the
+  // check-then-sleep below must not race the timekeeper's wakeup,
+  // which runs with the lock held.
+  while ((int)(deadline - ticks) > 0) {
     if (myproc()->killed) {
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(tickchan(deadline), &tickslock);
   }
   release(&tickslock);
   return 0;
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
-int sys_uptime(void) {
-  uint xticks;
+// futex(addr, op, val): user-level wait queues on a word of user
+// memory, so userspace mutexes block instead of spin-polling with
+// sleep(1).  FUTEX_WAIT sleeps while *addr == val; FUTEX_WAKE wakes
+// every waiter on addr.  The channel is the word's physical location
+// (via uva2ka), so it keeps working if the page is ever shared.
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+static struct spinlock ftxlock; // makes check-then-sleep atomic
+
+void futexinit(void) { initlock(&ftxlock, "futex"); }
+
+int sys_futex(void) {
+  struct proc *curproc = myproc();
+  int addr, op, val;
+  char *ka;
+
+  if (argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if (addr % 4 != 0 || !uaddrok(addr, 4))
+    return -1;
+  if ((ka = uva2ka(curproc->pgdir, (char *)addr)) == 0) {
+    // The page may be lazily allocated and not mapped yet.
+    if (lazyfault(curproc->pgdir, addr) < 0 ||
+        (ka = uva2ka(curproc->pgdir, (char *)addr)) == 0)
+      return -1;
+  }
+  ka += addr % PGSIZE;
+
+  switch (op) {
+  case FUTEX_WAIT:
+    acquire(&ftxlock);
+    while (*(int *)ka == val) {
+      if (curproc->killed) {
+        release(&ftxlock);
+        return -1;
+      }
+      sleep(ka, &ftxlock);
+    }
+    release(&ftxlock);
+    return 0;
+  case FUTEX_WAKE:
+    acquire(&ftxlock);
+    wakeup(ka);
+    release(&ftxlock);
+    return 0;
+  }
+  return -1;
+}
+
+// hrtime(out): high-resolution monotonic clock.  Fills out[0]/out[1]
+// with the low/high words of the cycle counter and out[2] with the
+// calibrated cycles per 100Hz tick (0 for the first ~200ms after
+// boot), so user code can convert cycles to wall time.  No locks.
+int sys_hrtime(void) {
+  uint *out;
+
+  if (argptr(0, (char **)&out, 3 * sizeof(uint)) < 0)
+    return -1;
+  rdtsc64(&out[0], &out[1]);
+  out[2] = tickcycles();
+  return 0;
+}
+
+// setpriority(pid, nice): set pid's scheduling band; see proc.c.
+int sys_setpriority(void) {
+  int pid, nice;
+
+  if (argint(0, &pid) < 0 || argint(1, &nice) < 0)
+    return -1;
+  return setpriority(pid, nice);
 }
+
+// lockstats(buf, max): copy the contention counters of up to max
+// kernel locks into buf, for finding hot locks from userspace.
+int sys_lockstats(void) {
+  char *buf;
+  int max;
+
+  if (argint(1, &max) < 0 || max < 0)
+    return -1;
+  // No more than NREGLOCK entries are ever copied out, and clamping
+  // first keeps the byte count below from overflowing into a buffer
+  // check smaller than what lockstats() writes.
+  if (max > NREGLOCK)
+    max = NREGLOCK;
+  if (argptr(0, &buf, max * sizeof(struct lockstat)) < 0)
+    return -1;
+  return lockstats((struct lockstat *)buf, max);
+}
+
+// Block until free physical memory falls below the kernel's low
+// watermark, so user-level caches can shed pages (free and
+// malloctrim) before kalloc() starts failing fork() for everyone.
+// Returns the free page count, or -1 if killed while waiting.
+int sys_memwait(void) { return memwait(); }
+
+// return how many clock tick interrupts have occurred
+// since start.  A word-sized read of the counter is atomic, so
+// reading the clock never contends with the timer interrupt.
+int sys_uptime(void) { return ticks; }
@@ -0,0 +1,226 @@
+// tmpfs: a RAM-backed filesystem on device TMPDEV, mounted at /tmp.
+// Inodes and file pages live purely in kernel memory, so short-lived
+// scratch files cost memcpy instead of log transactions and disk
+// traffic.  fs.c dispatches here on ip->dev at the points where the
+// disk filesystem would touch the buffer cache; the inode cache,
+// directory format, name cache and path walk are all shared, which
+// keeps tmpfs down to inode metadata and per-file page arrays.
+// Contents are lost at power-off, which is the point.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// A file holds NTDIRECT pages plus one indirect page of page
+// pointers: a little over 4MB, plenty for scratch files.
+#define NTDIRECT 12
+#define NTINDIRECT (BSIZE / sizeof(char *))
+#define NTINODE 128 // tmpfs files that may exist at once
+
+struct tnode {
+  short type; // 0 marks a free slot
+  short nlink;
+  uint size;
+  char *pages[NTDIRECT]; // kalloc'd data pages
+  char **ind;            // indirect page of page pointers
+};
+
+// The table is the backing store: the write-through inode cache in
+// fs.c loads from and stores to it in ilock()/iupdate(), the same
+// role the inode blocks play for the disk filesystem.  The lock
+// covers slot allocation and release; a live slot's contents are
+// covered by its inode's sleeplock, like a dinode's are.
+static struct {
+  struct spinlock lock;
+  struct tnode inode[NTINODE]; // indexed by inum; slot 0 unused
+} tmem;
+
+static struct tnode *tnode(uint inum) {
+  if (inum < 1 || inum >= NTINODE)
+    panic("tmpfs: bad inum");
+  return &tmem.inode[inum];
+}
+
+// Hand-build the root directory.  "." and ".." both name the root;
+// walking ".." out of the mount point is patched up in dirlookup(),
+// so the stored ".." inum is never used.
+void tmpfsinit(void) {
+  struct dirent *de;
+  struct tnode *tp;
+
+  initlock(&tmem.lock, "tmpfs");
+  tp = tnode(ROOTINO);
+  tp->type = T_DIR;
+  tp->nlink = 1;
+  if ((tp->pages[0] = kalloczero()) == 0)
+    panic("tmpfsinit");
+  de = (struct dirent *)tp->pages[0];
+  de[0].inum = ROOTINO;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  strncpy(de[1].name, "..", DIRSIZ);
+  tp->size = 2 * sizeof(struct dirent);
+}
+
+// Allocate a tmpfs inode of the given type; ialloc() dispatches
+// here for TMPDEV.  Returns the new inum.
+uint tmpfsialloc(short type) {
+  int i;
+
+  acquire(&tmem.lock);
+  for (i = 1; i < NTINODE; i++) {
+    if (tmem.inode[i].type == 0) {
+      tmem.inode[i].type = type;
+      release(&tmem.lock);
+      return i;
+    }
+  }
+  panic("tmpfsialloc: no inodes");
+}
+
+// Load the in-memory inode; ilock() dispatches here instead of
+// reading an inode block.
+void tmpfsiread(struct inode *ip) {
+  struct tnode *tp = tnode(ip->inum);
+
+  ip->type = tp->type;
+  ip->major = 0;
+  ip->minor = 0;
+  ip->nlink = tp->nlink;
+  ip->size = tp->size;
+}
+
+// Write the cached inode back; iupdate() dispatches here.  A zero
+// type is not stored: releasing the slot is tmpfsifree()'s job, so
+// a slot never looks free while its pages are still attached.
+void tmpfsiupdate(struct inode *ip) {
+  struct tnode *tp = tnode(ip->inum);
+
+  if (ip->type)
+    tp->type = ip->type;
+  tp->nlink = ip->nlink;
+  tp->size = ip->size;
+}
+
+// Release a tmpfs inode once its last link and reference are gone;
+// iput() dispatches here instead of clearing the inode bitmap.  The
+// pages were already freed by itrunc().
+void tmpfsifree(uint inum) {
+  struct tnode *tp = tnode(inum);
+
+  acquire(&tmem.lock);
+  memset(tp, 0, sizeof(*tp));
+  release(&tmem.lock);
+}
+
+// Return the slot for the page holding byte off, or 0 when off is
+// beyond the largest supported file.  Allocates the indirect page
+// if alloc is set.  Caller holds the inode's sleeplock.
+static char **tslot(struct tnode *tp, uint off, int alloc) {
+  uint pn = off / BSIZE;
+
+  if (pn < NTDIRECT)
+    return &tp->pages[pn];
+  pn -= NTDIRECT;
+  if (pn >= NTINDIRECT)
+    return 0;
+  if (tp->ind == 0) {
+    if (!alloc || (tp->ind = (char **)kalloczero()) == 0)
+      return 0;
+  }
+  return &tp->ind[pn];
+}
+
+// Copy n bytes at off out of ip; readi() dispatches here after
+// clamping the range to the file size.  Caller holds ip->lock.
+void tmpfsread(struct inode *ip, char *dst, uint off, uint n) {
+  struct tnode *tp = tnode(ip->inum);
+  char **slot;
+  uint tot, m;
+
+  for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+    m = min(n - tot, BSIZE - off % BSIZE);
+    slot = tslot(tp, off, 0);
+    if (slot == 0 || *slot == 0)
+      memset(dst, 0, m); // unwritten page reads as zeroes
+    else
+      memmove(dst, *slot + off % BSIZE, m);
+  }
+}
+
+// Copy n bytes at off into ip, allocating zeroed pages on demand;
+// writei() dispatches here and keeps the size update.  Returns -1
+// when the file would outgrow the page table or memory runs out.
+// Caller holds ip->lock.
+int tmpfswrite(struct inode *ip, char *src, uint off, uint n) {
+  struct tnode *tp = tnode(ip->inum);
+  char **slot;
+  uint tot, m;
+
+  if (off + n > (NTDIRECT + NTINDIRECT) * BSIZE)
+    return -1;
+  for (tot = 0; tot < n; tot += m, off += m, src += m) {
+    m = min(n - tot, BSIZE - off % BSIZE);
+    if ((slot = tslot(tp, off, 1)) == 0)
+      return -1;
+    if (*slot == 0 && (*slot = kalloczero()) == 0)
+      return -1;
+    memmove(*slot + off % BSIZE, src, m);
+  }
+  return n;
+}
+
+// Zero-copy read for the VM: return the page holding off with an
+// extra reference, as readpage() does with buffer-cache pages.
+// BSIZE == PGSIZE makes tmpfs pages directly mappable.  Caller
+// holds ip->lock.
+char *tmpfspage(struct inode *ip, uint off) {
+  struct tnode *tp = tnode(ip->inum);
+  char **slot;
+
+  if ((slot = tslot(tp, off, 1)) == 0)
+    return 0;
+  if (*slot == 0 && (*slot = kalloczero()) == 0)
+    return 0;
+  krefinc(*slot);
+  return *slot;
+}
+
+// Free ip's pages; itrunc() dispatches here.  kfree() respects the
+// page reference counts, so pages still mapped by mmap or exec
+// survive until the mappers drop them.  Caller holds ip->lock.
+void tmpfsitrunc(struct inode *ip) {
+  struct tnode *tp = tnode(ip->inum);
+  uint i;
+
+  for (i = 0; i < NTDIRECT; i++) {
+    if (tp->pages[i]) {
+      kfree(tp->pages[i]);
+      tp->pages[i] = 0;
+    }
+  }
+  if (tp->ind) {
+    for (i = 0; i < NTINDIRECT; i++)
+      if (tp->ind[i])
+        kfree(tp->ind[i]);
+    kfree((char *)tp->ind);
+    tp->ind = 0;
+  }
+  tp->size = 0;
+}
+
+// Type and size of inum, for getdents; dirstat() dispatches here.
+void tmpfsstat(uint inum, short *type, uint *size) {
+  struct tnode *tp = tnode(inum);
+
+  *type = tp->type;
+  *size = tp->size;
+}
@@ -14,7 +14,33 @@ void netintr();
 struct gatedesc idt[256];
 extern uint vectors[]; // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
-uint ticks;
+
+// The tick counter has one writer (CPU0, the timekeeper) and many
+// readers.  An aligned word-sized read is atomic on x86, so readers
+// never take tickslock; volatile keeps the compiler from caching a
+// stale value across a wait loop.  The lock survives only to order
+// the increment against sleepers parking on the timer wheel below:
+// their check-then-sleep must not race the wakeup.
+volatile uint ticks;
+
+// Timer wheel for sleeping processes: a sleeper parks on the wheel
+// slot its wake deadline hashes to, so each tick wakes only the
+// sleepers whose deadline lands in the current slot instead of
+// broadcasting to every sleeper in the system.  Slots are pure sleep
+// channels; a woken process re-checks its own deadline and parks
+// again if its slot merely collided.
+#define NTWHEEL 32
+static uint twheel[NTWHEEL];
+
+// Cycles-per-tick calibration for sys_hrtime(): sample the cycle
+// counter ten ticks apart early in boot; 0 until then.
+static uint calcyc, cpt;
+
+// Sleep channel for processes whose wake deadline is tick t.
+void *tickchan(uint t) { return &twheel[t % NTWHEEL]; }
+
+// How many cycles one timer tick spans, once calibrated.
+uint tickcycles(void) { return cpt; }
 
 void tvinit(void) {
   int i;
@@ -28,7 +54,102 @@ void tvinit(void) {
 
 void idtinit(void) { lidt(idt, sizeof(idt)); }
 
+// Per-CPU FPU/SSE setup: enable fxsave and SSE, route numeric errors
+// through exceptions, and set CR0.TS so the first FPU touch by any
+// process traps to fputrap() below.
+void fpuinit(void) {
+  lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+  lcr0((rcr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+}
+
+// Device-not-available: the process touched the FPU/SSE while CR0.TS
+// was set.  Clear TS and give it the FPU; a process that never gets
+// here never pays for the 512-byte state.  scheduler() saves the
+// state and re-arms TS when the owner is switched out.
+static void fputrap(void) {
+  struct proc *p = myproc();
+
+  lcr0(rcr0() & ~CR0_TS);
+  if (p->usedfpu)
+    fxrstor(p->fpstate);
+  else {
+    fninit();
+    ldmxcsr(0x1F80); // power-on MXCSR: all exceptions masked
+    p->usedfpu = 1;
+  }
+  mycpu()->fpuproc = p;
+}
+
+// Try to resolve a fault at user address va: swapped-out,
+// copy-on-write, demand-paged, mmap'd and lazily allocated heap pages
+// are repaired; anything else is a real fault.  Returns 0 if the
+// faulting access can be retried.  Shared by the page-fault trap and
+// uprefault() below.
+int uvarepair(struct proc *p, uint va) {
+  if (p == 0 || va >= KERNBASE)
+    return -1;
+  if (swapfault(p->pgdir, va) == 0 || cowfault(p->pgdir, va) == 0 ||
+      execfault(p, va) == 0 ||
+      mmapfault(p, va) == 0 || (va < p->sz && lazyfault(p->pgdir, va) == 0)) {
+    p->npgflt++;
+    return 0;
+  }
+  return -1;
+}
+
+// The repair itself is serialized against the async I/O worker's
+// resolves of this page table (see iouserpage in ioring.c); the
+// guards are no-ops for a process with no ring.
+static int pagefault(struct trapframe *tf) {
+  struct proc *p = myproc();
+  int r;
+
+  iofaultlock(p);
+  r = uvarepair(p, rcr2());
+  iofaultunlock(p);
+  return r;
+}
+
+// Resolve every page of the user range [addr, addr+n) now, in process
+// context.  Kernel code that copies through a user buffer while
+// holding a spinlock cannot take the page fault there: repairing the
+// page sleeps on disk I/O, and sleeping with a spinlock held panics.
+// Such code calls this before acquiring the lock (and again after any
+// sleep, since a sleeping process's pages can be swapped out).
+// Returns 0 once every page is present, -1 if one cannot be.
+int uprefault(char *addr, uint n) {
+  struct proc *p = myproc();
+  uint a, last;
+
+  if (n == 0 || (uint)addr >= KERNBASE)
+    return 0; // kernel buffers are always mapped
+  a = PGROUNDDOWN((uint)addr);
+  last = PGROUNDDOWN((uint)addr + n - 1);
+  iofaultlock(p);
+  for (; a <= last; a += PGSIZE) {
+    if (uva2ka(p->pgdir, (char *)a) == 0 &&
+        (uvarepair(p, a) < 0 || uva2ka(p->pgdir, (char *)a) == 0)) {
+      iofaultunlock(p);
+      return -1;
+    }
+  }
+  iofaultunlock(p);
+  return 0;
+}
+
 // PAGEBREAK: 41
+// Fast syscall path, entered from sysentry (trapasm.S) on sysenter.
+// Same contract as the T_SYSCALL arm of trap() below, without the
+// vector table or trapno demux in between.
+void syscalltrap(struct trapframe *tf) {
+  if (myproc()->killed)
+    exit();
+  myproc()->tf = tf;
+  syscall();
+  if (myproc()->killed)
+    exit();
+}
+
 void trap(struct trapframe *tf) {
   if (tf->trapno == T_SYSCALL) {
     if (myproc()->killed)
@@ -41,21 +162,53 @@ void trap(struct trapframe *tf) {
   }
 
   switch (tf->trapno) {
-  case T_IRQ0 + IRQ_TIMER:
+  case T_IRQ0 + IRQ_TIMER: {
+    // A stretched tick (see below) stands for mult base ticks, so
+    // all accounting advances by mult.  CPU0 is the timekeeper and
+    // must wake every tick channel it would otherwise skip.
+    int i, mult, newmult;
+
+    mult = mycpu()->tickmult;
+    if (mult == 0) // first tick on this CPU
+      mult = 1;
+    profsample(tf);
+    if (myproc())
+      myproc()->cputicks += mult;
     if (cpuid() == 0) {
       acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
+      for (i = 0; i < mult; i++) {
+        ticks++;
+        if (ticks == 10)
+          calcyc = rdtsc();
+        else if (ticks == 20)
+          cpt = (rdtsc() - calcyc) / 10;
+        wakeup(tickchan(ticks));
+      }
       release(&tickslock);
+      kpresscheck(); // wake memwait() sleepers if memory is low
+    }
+
+    // Dynamic tick: with nothing queued behind the running process
+    // there is nobody to preempt for, so stretch the timer period;
+    // competition snaps it back on its next tick.  Hold off until
+    // the cycles-per-tick calibration at ticks 10..20 is done.
+    newmult = (ticks > 20 && rqempty()) ? TICKSTRETCH : 1;
+    if (newmult != mycpu()->tickmult) {
+      mycpu()->tickmult = newmult;
+      lapicsettick(newmult);
     }
     lapiceoi();
     break;
+  }
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
     break;
-  case T_IRQ0 + IRQ_IDE + 1:
-    // Bochs generates spurious IDE1 interrupts.
+  case T_IRQ0 + IRQ_IDE2:
+    // Secondary channel when striping; Bochs also generates spurious
+    // interrupts here, which ideintr2() ignores (empty queue).
+    ideintr2();
+    lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -69,12 +222,27 @@ void trap(struct trapframe *tf) {
     netintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Wakeup IPI from rqput(): its only job was to end this CPU's
+    // hlt; the scheduler loop finds the new work itself.
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n", cpuid(), tf->cs, tf->eip);
     lapiceoi();
     break;
 
+  case T_DEVICE:
+    if (myproc() == 0 || (tf->cs & 3) == 0)
+      panic("fpu use in kernel");
+    fputrap();
+    break;
+
+  case T_PGFLT:
+    if (pagefault(tf) == 0)
+      break;
+    // fall through: unrepairable fault
   // PAGEBREAK: 13
   default:
     if (myproc() == 0 || (tf->cs & 3) == 0) {
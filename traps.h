@@ -34,5 +34,7 @@
 #define IRQ_COM1 4
 #define IRQ_PCI0 11
 #define IRQ_IDE 14
+#define IRQ_IDE2 15
 #define IRQ_ERROR 19
+#define IRQ_WAKE 20 // scheduler wakeup IPI, not a hardware line (lapic.c)
 #define IRQ_SPURIOUS 31
@@ -16,9 +16,24 @@
 
 static int uart; // is there a uart?
 
+// Transmit ring.  uartputc() enqueues and returns; the bytes are
+// pushed to the port from uartintr() whenever the transmit holding
+// register drains, so writers no longer sit in a microdelay() poll
+// for every byte.
+#define UARTTXBUF 512
+
+static struct {
+  struct spinlock lock;
+  char buf[UARTTXBUF];
+  uint r; // next byte to transmit
+  uint w; // next free slot
+} tx;
+
 void uartinit(void) {
   char *p;
 
+  initlock(&tx.lock, "uart");
+
   // Turn off the FIFO
   outb(COM1 + 2, 0);
 
@@ -36,9 +51,10 @@ void uartinit(void) {
   uart = 1;
 
   // Acknowledge pre-existing interrupt conditions;
-  // enable interrupts.
+  // enable receive and transmitter-empty interrupts.
   inb(COM1 + 2);
   inb(COM1 + 0);
+  outb(COM1 + 1, 0x03);
   ioapicenable(IRQ_COM1, 0);
 
   // Announce that we're here.
@@ -46,14 +62,49 @@ void uartinit(void) {
     uartputc(*p);
 }
 
-void uartputc(int c) {
+// Emit one buffered byte the old way: poll the line status register
+// with a bounded delay, then write regardless.  Caller holds tx.lock.
+static void uartforce(void) {
   int i;
 
-  if (!uart)
-    return;
   for (i = 0; i < 128 && !(inb(COM1 + 5) & 0x20); i++)
     microdelay(10);
-  outb(COM1 + 0, c);
+  outb(COM1 + 0, tx.buf[tx.r % UARTTXBUF]);
+  tx.r++;
+}
+
+// Push buffered bytes to the port while the transmit holding register
+// is empty.  Caller holds tx.lock.
+static void uartstart(void) {
+  while (tx.r != tx.w && (inb(COM1 + 5) & 0x20)) {
+    outb(COM1 + 0, tx.buf[tx.r % UARTTXBUF]);
+    tx.r++;
+  }
+}
+
+void uartputc(int c) {
+  if (!uart)
+    return;
+  acquire(&tx.lock);
+  // If a burst outpaces the interrupt-driven drain, make room
+  // synchronously rather than drop log output.
+  if (tx.w - tx.r == UARTTXBUF)
+    uartforce();
+  tx.buf[tx.w % UARTTXBUF] = c;
+  tx.w++;
+  uartstart();
+  release(&tx.lock);
+}
+
+// Poll until the ring is empty.  panic() freezes with interrupts off
+// and would otherwise lose whatever is still buffered.
+void uartflush(void) {
+  if (!uart)
+    return;
+  acquire(&tx.lock);
+  while (tx.r != tx.w)
+    uartforce();
+  release(&tx.lock);
 }
 
 static int uartgetc(void) {
@@ -64,4 +115,10 @@ static int uartgetc(void) {
   return inb(COM1 + 0);
 }
 
-void uartintr(void) { consoleintr(uartgetc); }
+void uartintr(void) {
+  inb(COM1 + 2); // ack a transmitter-empty interrupt
+  acquire(&tx.lock);
+  uartstart();
+  release(&tx.lock);
+  consoleintr(uartgetc);
+}
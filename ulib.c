@@ -86,3 +86,153 @@ void *memmove(void *vdst, const void *vsrc, int n) {
     *dst++ = *src++;
   return vdst;
 }
+
+// Buffered file I/O.  Streams come from a small static table rather
+// than malloc so they work before the heap is set up and cost nothing
+// in programs that never use them.
+#define NFTAB 8
+static FILE ftab[NFTAB];
+static char ftaken[NFTAB];
+
+// Wrap an already-open descriptor.  mode is "r" or "w"; a stream
+// moves data in one direction only.
+FILE *fdopen(int fd, const char *mode) {
+  FILE *f;
+  int i;
+
+  if (fd < 0 || (mode[0] != 'r' && mode[0] != 'w'))
+    return 0;
+  for (i = 0; i < NFTAB; i++)
+    if (!ftaken[i])
+      break;
+  if (i == NFTAB)
+    return 0;
+  ftaken[i] = 1;
+  f = &ftab[i];
+  f->fd = fd;
+  f->writing = mode[0] == 'w';
+  f->n = 0;
+  f->off = 0;
+  return f;
+}
+
+FILE *fopen(const char *path, const char *mode) {
+  FILE *f;
+  int fd;
+
+  fd = open(path, mode[0] == 'w' ? O_CREATE | O_WRONLY : O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if ((f = fdopen(fd, mode)) == 0)
+    close(fd);
+  return f;
+}
+
+// Write out any buffered output.  Returns 0, or -1 on a short write.
+int fflush(FILE *f) {
+  int n;
+
+  if (f->writing && f->n > 0) {
+    n = f->n;
+    f->n = 0;
+    if (write(f->fd, f->buf, n) != n)
+      return -1;
+  }
+  return 0;
+}
+
+int fclose(FILE *f) {
+  int r;
+
+  r = fflush(f);
+  close(f->fd);
+  f->fd = -1;
+  f->n = 0;
+  ftaken[f - ftab] = 0;
+  return r;
+}
+
+// Read up to n bytes.  Returns the count read, 0 at end of file, or
+// -1 on error.  Large reads that find the buffer empty go straight
+// to read() to avoid copying through the buffer.
+int fread(FILE *f, void *dst, int n) {
+  char *p;
+  int m, r, got;
+
+  p = dst;
+  got = 0;
+  while (got < n) {
+    if (f->off == f->n) {
+      if (n - got >= FBUFSIZE) {
+        r = read(f->fd, p + got, n - got);
+        if (r < 0)
+          return got > 0 ? got : -1;
+        got += r;
+        if (r == 0)
+          break;
+        continue;
+      }
+      f->off = 0;
+      f->n = read(f->fd, f->buf, FBUFSIZE);
+      if (f->n <= 0) {
+        r = f->n;
+        f->n = 0;
+        if (r < 0 && got == 0)
+          return -1;
+        break;
+      }
+    }
+    m = f->n - f->off;
+    if (m > n - got)
+      m = n - got;
+    memmove(p + got, f->buf + f->off, m);
+    f->off += m;
+    got += m;
+  }
+  return got;
+}
+
+// Buffer n bytes of output, flushing as the buffer fills.  Returns n,
+// or -1 on a write error.  Large writes bypass the buffer.
+int fwrite(FILE *f, const void *src, int n) {
+  const char *p;
+  int m, put;
+
+  p = src;
+  put = 0;
+  while (put < n) {
+    if (f->n == 0 && n - put >= FBUFSIZE) {
+      if (write(f->fd, (char *)p + put, n - put) != n - put)
+        return -1;
+      put = n;
+      break;
+    }
+    m = FBUFSIZE - f->n;
+    if (m > n - put)
+      m = n - put;
+    memmove(f->buf + f->n, p + put, m);
+    f->n += m;
+    put += m;
+    if (f->n == FBUFSIZE && fflush(f) < 0)
+      return -1;
+  }
+  return n;
+}
+
+// Next byte of input, or -1 at end of file or on error.
+int fgetc(FILE *f) {
+  if (f->off == f->n) {
+    f->off = 0;
+    f->n = read(f->fd, f->buf, FBUFSIZE);
+    if (f->n <= 0) {
+      f->n = 0;
+      return -1;
+    }
+  }
+  return (uchar)f->buf[f->off++];
+}
+
+int fputc(FILE *f, int c) {
+  char b = c;
+  return fwrite(f, &b, 1) == 1 ? c : -1;
+}
@@ -3,82 +3,132 @@
 #include "user.h"
 #include "param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class memory allocator.
+//
+// Small requests are rounded up to one of a few power-of-two classes,
+// each with its own free list carved in bulk from page-sized sbrk()
+// slabs, so malloc and free are a constant-time list pop and push
+// instead of the old first-fit scan.  Larger requests get page-rounded
+// blocks tracked on a separate first-fit list.  Freed memory is kept
+// for reuse rather than coalesced or returned to the kernel, trading
+// modest fragmentation for constant-time operation; malloctrim() gives
+// back what happens to sit at the top of the heap when asked.
 
-typedef long Align;
+#define NCLASS 8
+#define MINCLASS 16   // smallest chunk, including the header
+#define MAXCLASS 2048 // largest class chunk
+#define SLABSIZE 4096 // sbrk granularity for small classes
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *next; // next free chunk on the same list
+    uint info;          // class index, or byte size if >= NCLASS
   } s;
-  Align x;
+  long x[2]; // force 8-byte chunk alignment
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+static Header *freelist[NCLASS]; // small chunks, by class
+static Header *bigfree;          // page-rounded large blocks
 
-void free(void *ap) {
-  Header *bp, *p;
-
-  bp = (Header *)ap - 1;
-  for (p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if (p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if (bp + bp->s.size == p->s.ptr) {
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if (p + p->s.size == bp) {
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+// Chunk size in bytes for a class, and the smallest class holding n
+// bytes.  MINCLASS << (NCLASS-1) == MAXCLASS.
+static uint classsize(int c) { return MINCLASS << c; }
+
+static int sizeclass(uint n) {
+  int c;
+
+  for (c = 0; classsize(c) < n; c++)
+    ;
+  return c;
 }
 
-static Header *morecore(uint nu) {
-  char *p;
-  Header *hp;
+void *malloc(uint nbytes) {
+  Header *h, **pp;
+  uint n;
+  int c;
+  char *p, *end;
+
+  if (nbytes == 0)
+    return 0;
+  n = nbytes + sizeof(Header);
+
+  if (n <= MAXCLASS) {
+    c = sizeclass(n);
+    if (freelist[c] == 0) {
+      // Carve a fresh slab into chunks of this class.
+      if ((p = sbrk(SLABSIZE)) == (char *)-1)
+        return 0;
+      for (end = p + SLABSIZE; p + classsize(c) <= end; p += classsize(c)) {
+        h = (Header *)p;
+        h->s.info = c;
+        h->s.next = freelist[c];
+        freelist[c] = h;
+      }
+    }
+    h = freelist[c];
+    freelist[c] = h->s.next;
+    return (void *)(h + 1);
+  }
 
-  if (nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if (p == (char *)-1)
+  // Large request: reuse the first free block that fits, else grow.
+  n = (n + SLABSIZE - 1) & ~(SLABSIZE - 1);
+  for (pp = &bigfree; (h = *pp) != 0; pp = &h->s.next) {
+    if (h->s.info >= n) {
+      *pp = h->s.next;
+      return (void *)(h + 1);
+    }
+  }
+  if ((p = sbrk(n)) == (char *)-1)
     return 0;
-  hp = (Header *)p;
-  hp->s.size = nu;
-  free((void *)(hp + 1));
-  return freep;
+  h = (Header *)p;
+  h->s.info = n;
+  return (void *)(h + 1);
 }
 
-void *malloc(uint nbytes) {
-  Header *p, *prevp;
-  uint nunits;
+void free(void *ap) {
+  Header *h;
 
-  nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
-  if ((prevp = freep) == 0) {
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if (ap == 0)
+    return;
+  h = (Header *)ap - 1;
+  if (h->s.info < NCLASS) {
+    h->s.next = freelist[h->s.info];
+    freelist[h->s.info] = h;
+  } else {
+    h->s.next = bigfree;
+    bigfree = h;
   }
-  for (p = prevp->s.ptr;; prevp = p, p = p->s.ptr) {
-    if (p->s.size >= nunits) {
-      if (p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+}
+
+// Return heap memory to the kernel, malloc_trim-style: release every
+// free large block that ends at the current break, shrinking the break
+// with negative sbrk().  Repeats until the topmost block is live, so a
+// run of adjacent free blocks all goes back.  Small-class slabs stay:
+// their chunks are scattered across the free lists and one live chunk
+// pins a whole slab.  Returns the number of bytes released.  Intended
+// to run after shedding caches when memwait() reports pressure.
+int malloctrim(void) {
+  Header *h, **pp;
+  char *brk;
+  uint released;
+  int again;
+
+  released = 0;
+  brk = sbrk(0);
+  do {
+    again = 0;
+    for (pp = &bigfree; (h = *pp) != 0; pp = &h->s.next) {
+      if ((char *)h + h->s.info == brk) {
+        *pp = h->s.next;
+        brk = (char *)h;
+        released += h->s.info;
+        sbrk(-(int)h->s.info);
+        again = 1;
+        break;
       }
-      freep = prevp;
-      return (void *)(p + 1);
     }
-    if (p == freep)
-      if ((p = morecore(nunits)) == 0)
-        return 0;
-  }
+  } while (again);
+  return released;
 }
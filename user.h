@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct fsstat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -31,6 +34,45 @@ int accept();
 int send(int, const void *, int);
 int recv(int, const void *, int);
 int shutdown(int);
+int splice(int, int, int);
+int futex(void *, int, int); // op 0: wait while *addr == val; op 1: wake
+void *mmap(int fd, uint off, int len); // read-only file mapping
+int pread(int, void *, int, uint);
+int pwrite(int, const void *, int, uint);
+int lockstats(struct lockstat *, int);
+int hrtime(uint *); // out[0..1] = tsc lo/hi, out[2] = cycles per tick
+int shmget(int key, int size); // find or create a shared memory segment
+void *shmat(int id);           // map segment into this process
+int spawn(char *, char **);    // fork+exec without the fork; returns pid
+int fsstats(struct fsstat *);  // bcache/icache/log counters
+int getdents(int, void *, int); // batch of struct dent (fs.h); bytes filled
+int setpriority(int pid, int nice); // -2 (latency-critical) .. 2 (background)
+int iosetup(void); // map an async I/O ring (ioring.h); returns its address
+int ioenter(int nwait); // submit queued ring entries, wait for nwait results
+int memwait(void); // block until kernel memory is low; returns free pages
+int readv(int, struct iovec *, int);  // scatter one read (fcntl.h)
+int writev(int, struct iovec *, int); // gather one write
+
+// Buffered file I/O (ulib.c).  A FILE wraps a descriptor with a 4KB
+// buffer so byte- and line-grained programs do not pay one syscall
+// per character.  Writers must fflush() or fclose() before exit().
+#define FBUFSIZE 4096
+typedef struct {
+  int fd;      // underlying descriptor; -1 marks a free slot
+  int writing; // buffer holds pending output, not read-ahead
+  int n;       // valid bytes (reading) or pending bytes (writing)
+  int off;     // next unread byte when reading
+  char buf[FBUFSIZE];
+} FILE;
+
+FILE *fopen(const char *, const char *); // mode "r" or "w"
+FILE *fdopen(int, const char *);
+int fclose(FILE *);
+int fflush(FILE *);
+int fread(FILE *, void *, int);
+int fwrite(FILE *, const void *, int);
+int fgetc(FILE *);
+int fputc(FILE *, int);
 
 // ulib.c
 int stat(const char *, struct stat *);
@@ -44,4 +86,5 @@ uint strlen(const char *);
 void *memset(void *, int, uint);
 void *malloc(uint);
 void free(void *);
+int malloctrim(void); // shrink the break past freed blocks; bytes released
 int atoi(const char *);
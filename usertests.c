@@ -1676,7 +1676,145 @@ unsigned int rand() {
   return randstate;
 }
 
+// Every test in run order.  exectest stays out of the table: it
+// replaces this process via exec and so must always run last and
+// cannot be timed.
+struct test {
+  char *name;
+  void (*fn)(void);
+} tests[] = {
+    {"argptest", argptest},
+    {"createdelete", createdelete},
+    {"linkunlink", linkunlink},
+    {"concreate", concreate},
+    {"fourfiles", fourfiles},
+    {"sharedfd", sharedfd},
+    {"bigargtest", bigargtest},
+    {"bigwrite", bigwrite},
+    {"bigargtest2", bigargtest},
+    {"bsstest", bsstest},
+    {"sbrktest", sbrktest},
+    {"validatetest", validatetest},
+    {"opentest", opentest},
+    {"writetest", writetest},
+    {"writetest1", writetest1},
+    {"createtest", createtest},
+    {"openiputtest", openiputtest},
+    {"exitiputtest", exitiputtest},
+    {"iputtest", iputtest},
+    {"mem", mem},
+    {"pipe1", pipe1},
+    {"preempt", preempt},
+    {"exitwait", exitwait},
+    {"rmdot", rmdot},
+    {"fourteen", fourteen},
+    {"bigfile", bigfile},
+    {"subdir", subdir},
+    {"linktest", linktest},
+    {"unlinkread", unlinkread},
+    {"dirfile", dirfile},
+    {"iref", iref},
+    {"forktest", forktest},
+    {"bigdir", bigdir}, // slow
+    {"uio", uio},
+};
+#define NTESTS (sizeof(tests) / sizeof(tests[0]))
+
+// 64-bit cycle counts as 16 hex digits, so the timing table needs
+// neither 64-bit division nor printf changes.
+void hex64(uint hi, uint lo, char *s) {
+  static char dig[] = "0123456789abcdef";
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    s[7 - i] = dig[(hi >> (4 * i)) & 15];
+    s[15 - i] = dig[(lo >> (4 * i)) & 15];
+  }
+  s[16] = 0;
+}
+
+int parsehex64(char *s, uint *hi, uint *lo) {
+  uint v;
+
+  *hi = *lo = 0;
+  for (; *s && *s != '\n'; s++) {
+    if (*s >= '0' && *s <= '9')
+      v = *s - '0';
+    else if (*s >= 'a' && *s <= 'f')
+      v = *s - 'a' + 10;
+    else
+      return -1;
+    *hi = (*hi << 4) | (*lo >> 28);
+    *lo = (*lo << 4) | v;
+  }
+  return 0;
+}
+
+// A stored baseline: "TIME <name> <16 hex digits>" per line, i.e.
+// exactly what a timed run prints, so "usertests -t > base" followed
+// by "usertests -t base" (on a fresh fs.img) compares deploys.
+struct baseent {
+  char name[32];
+  uint hi, lo;
+} base[NTESTS];
+int nbase;
+
+void loadbase(char *path) {
+  FILE *f;
+  char line[64], *p, *q;
+  int c, n;
+
+  if ((f = fopen(path, "r")) == 0) {
+    printf(1, "usertests: cannot open baseline %s\n", path);
+    exit();
+  }
+  n = 0;
+  while (nbase < NTESTS) {
+    while ((c = fgetc(f)) >= 0 && c != '\n')
+      if (n < sizeof(line) - 1)
+        line[n++] = c;
+    if (n == 0 && c < 0)
+      break;
+    line[n] = 0;
+    n = 0;
+    if (strcmp(line, "") == 0 || line[0] != 'T')
+      continue;
+    p = strchr(line, ' ');
+    if (p == 0 || (q = strchr(p + 1, ' ')) == 0)
+      continue;
+    *q = 0;
+    strcpy(base[nbase].name, p + 1);
+    if (parsehex64(q + 1, &base[nbase].hi, &base[nbase].lo) == 0)
+      nbase++;
+  }
+  fclose(f);
+}
+
+// Did (hi, lo) cycles regress more than 25% past the baseline entry
+// for name?  Unknown names pass.
+int regressed(char *name, uint hi, uint lo) {
+  uint bhi, blo, shi, slo;
+  int i;
+
+  for (i = 0; i < nbase; i++)
+    if (strcmp(base[i].name, name) == 0)
+      break;
+  if (i == nbase)
+    return 0;
+  bhi = base[i].hi;
+  blo = base[i].lo;
+  // allowed = base + base/4, in shifts and adds only
+  slo = blo + ((blo >> 2) | (bhi << 30));
+  shi = bhi + (bhi >> 2) + (slo < blo);
+  return hi > shi || (hi == shi && lo > slo);
+}
+
 int main(int argc, char *argv[]) {
+  uint t0[3], t1[3], dhi, dlo;
+  char hex[17];
+  int i, timed, nregress;
+
+  timed = argc > 1 && strcmp(argv[1], "-t") == 0;
   printf(1, "usertests starting\n");
 
   if (open("usertests.ran", 0) >= 0) {
@@ -1685,46 +1823,33 @@ int main(int argc, char *argv[]) {
   }
   close(open("usertests.ran", O_CREATE));
 
-  argptest();
-  createdelete();
-  linkunlink();
-  concreate();
-  fourfiles();
-  sharedfd();
-
-  bigargtest();
-  bigwrite();
-  bigargtest();
-  bsstest();
-  sbrktest();
-  validatetest();
-
-  opentest();
-  writetest();
-  writetest1();
-  createtest();
-
-  openiputtest();
-  exitiputtest();
-  iputtest();
-
-  mem();
-  pipe1();
-  preempt();
-  exitwait();
-
-  rmdot();
-  fourteen();
-  bigfile();
-  subdir();
-  linktest();
-  unlinkread();
-  dirfile();
-  iref();
-  forktest();
-  bigdir(); // slow
-
-  uio();
+  if (timed && argc > 2)
+    loadbase(argv[2]);
+
+  nregress = 0;
+  for (i = 0; i < NTESTS; i++) {
+    hrtime(t0);
+    tests[i].fn();
+    hrtime(t1);
+    if (!timed)
+      continue;
+    dlo = t1[0] - t0[0];
+    dhi = t1[1] - t0[1] - (t1[0] < t0[0]);
+    hex64(dhi, dlo, hex);
+    printf(1, "TIME %s %s\n", tests[i].name, hex);
+    if (regressed(tests[i].name, dhi, dlo)) {
+      printf(1, "REGRESSION %s\n", tests[i].name);
+      nregress++;
+    }
+  }
+
+  if (timed) {
+    if (nregress)
+      printf(1, "usertests: %d test(s) regressed\n", nregress);
+    else
+      printf(1, "usertests: no regressions\n");
+    exit();
+  }
 
   exectest();
 
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
 #include "elf.h"
 
 extern char data[]; // defined by kernel.ld
@@ -25,6 +26,19 @@ void seginit(void) {
   c->gdt[SEG_UCODE] = SEG(STA_X | STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Fast syscall path: sysenter enters at sysentry (trapasm.S) on
+  // the kernel stack named by MSR_SYSENTER_ESP, which switchuvm()
+  // keeps current.  sysexit depends on exactly this GDT layout: user
+  // code and data two slots above their kernel counterparts.
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3, 0);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry, 0);
+  wrmsr(MSR_SYSENTER_ESP, 0, 0);
+
+  // Make kernel-mode writes honor PTE_W, so that stores through
+  // kernel addresses into user buffers (readi, copyout, ...) fault on
+  // copy-on-write pages instead of silently writing the shared frame.
+  lcr0(rcr0() | CR0_WP);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -36,12 +50,13 @@ static pte_t *walkpgdir(pde_t *pgdir, const void *va, int alloc) {
 
   pde = &pgdir[PDX(va)];
   if (*pde & PTE_P) {
+    if (*pde & PTE_PS)
+      panic("walkpgdir: superpage");
     pgtab = (pte_t *)P2V(PTE_ADDR(*pde));
   } else {
-    if (!alloc || (pgtab = (pte_t *)kalloc()) == 0)
+    // All those PTE_P bits must start out zero.
+    if (!alloc || (pgtab = (pte_t *)kalloczero()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -52,14 +67,29 @@ static pte_t *walkpgdir(pde_t *pgdir, const void *va, int alloc) {
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned.
-static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm) {
+// be page-aligned.  Stretches that are 4MB-aligned in both va and pa
+// get a single PTE_PS directory entry instead of an inner page
+// table, saving a page of table memory and a TLB entry per 4MB.
+int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm) {
   char *a, *last;
   pte_t *pte;
+  pde_t *pde;
 
   a = (char *)PGROUNDDOWN((uint)va);
   last = (char *)PGROUNDDOWN(((uint)va) + size - 1);
   for (;;) {
+    if ((uint)a % PTSIZE == 0 && pa % PTSIZE == 0 &&
+        (uint)(last - a) >= PTSIZE - PGSIZE) {
+      pde = &pgdir[PDX(a)];
+      if (*pde & PTE_P)
+        panic("remap");
+      *pde = pa | perm | PTE_PS | PTE_P;
+      if ((uint)(last - a) < PTSIZE)
+        break;
+      a += PTSIZE;
+      pa += PTSIZE;
+      continue;
+    }
     if ((pte = walkpgdir(pgdir, a, 1)) == 0)
       return -1;
     if (*pte & PTE_P)
@@ -113,9 +143,8 @@ pde_t *setupkvm(void) {
   pde_t *pgdir;
   struct kmap *k;
 
-  if ((pgdir = (pde_t *)kalloc()) == 0)
+  if ((pgdir = (pde_t *)kalloczero()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void *)DEVSPACE)
     panic("PHYSTOP too high");
   for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -127,18 +156,44 @@ pde_t *setupkvm(void) {
   return pgdir;
 }
 
+// Deferred top-level page-directory pages.  An idle cpu parks with
+// its last process's cr3 still loaded (see scheduler()); its
+// kernel-address walks go through that one top-level page, so the
+// page can't be reused until every cpu has moved off it.  At most
+// ncpu entries can be in use at once, so the table never fills.
+#define NGRAVE (2 * NCPU)
+static struct {
+  struct spinlock lock;
+  pde_t *pg[NGRAVE];
+  int n;
+} grave;
+
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 void kvmalloc(void) {
+  initlock(&grave.lock, "pgdirgrave");
   kpgdir = setupkvm();
-  switchkvm();
+  // Too early for mycpu()/loadpgdir(); load cr3 directly.
+  lcr3(V2P(kpgdir));
+}
+
+// Load cr3 only if it actually changes; the reload's implied TLB
+// flush is the expensive part, and redispatching the same process on
+// the same cpu shouldn't pay it.  The cached value is updated after
+// the load so pgdirfree() never sees a page table released from cr3
+// before it really is.
+static void loadpgdir(pde_t *pgdir) {
+  pushcli();
+  if (mycpu()->curpgdir != pgdir) {
+    lcr3(V2P(pgdir));
+    mycpu()->curpgdir = pgdir;
+  }
+  popcli();
 }
 
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
-void switchkvm(void) {
-  lcr3(V2P(kpgdir)); // switch to the kernel page table
-}
+void switchkvm(void) { loadpgdir(kpgdir); }
 
 // Switch TSS and h/w page table to correspond to process p.
 void switchuvm(struct proc *p) {
@@ -155,11 +210,12 @@ void switchuvm(struct proc *p) {
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE, 0);
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort)0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir)); // switch to process's address space
+  loadpgdir(p->pgdir); // switch to process's address space
   popcli();
 }
 
@@ -211,13 +267,14 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
 
   a = PGROUNDUP(oldsz);
   for (; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    mem = kalloczero();
+    if (mem == 0 && swapout() > 0)
+      mem = kalloczero();
     if (mem == 0) {
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pgdir, (char *)a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -251,11 +308,54 @@ int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if (*pte & PTE_SWAP) {
+      swapfree(*pte >> 12);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
+// Is pgdir loaded in any cpu's cr3?  Also used by swapvictim() in
+// proc.c: evicting pages from a loaded page table would leave stale
+// TLB entries behind, since loadpgdir() elides the cr3 reload.
+int pgdirinuse(pde_t *pgdir) {
+  int i;
+
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].curpgdir == pgdir)
+      return 1;
+  return 0;
+}
+
+// Free the deferred directory pages no cpu references anymore.
+// Caller holds grave.lock.
+static void gravesweep(void) {
+  int i;
+
+  for (i = 0; i < grave.n;) {
+    if (!pgdirinuse(grave.pg[i])) {
+      kfree((char *)grave.pg[i]);
+      grave.pg[i] = grave.pg[--grave.n];
+    } else
+      i++;
+  }
+}
+
+// Release a top-level directory page, deferring it while some idle
+// cpu still has it in cr3.
+static void pgdirfree(pde_t *pgdir) {
+  acquire(&grave.lock);
+  gravesweep();
+  if (pgdirinuse(pgdir)) {
+    if (grave.n >= NGRAVE)
+      panic("pgdirfree");
+    grave.pg[grave.n++] = pgdir;
+  } else
+    kfree((char *)pgdir);
+  release(&grave.lock);
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void freevm(pde_t *pgdir) {
@@ -265,12 +365,13 @@ void freevm(pde_t *pgdir) {
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for (i = 0; i < NPDENTRIES; i++) {
-    if (pgdir[i] & PTE_P) {
+    // Superpage entries have no inner page table to free.
+    if ((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)) {
       char *v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
   }
-  kfree((char *)pgdir);
+  pgdirfree(pgdir);
 }
 
 // Clear PTE_U on a page. Used to create an inaccessible
@@ -284,48 +385,207 @@ void clearpteu(pde_t *pgdir, char *uva) {
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
+// Given a parent process's page table, create a copy-on-write copy of
+// it for a child: both processes share the parent's physical pages
+// read-only, and cowfault() copies a page only when one of them
+// actually writes it.
 pde_t *copyuvm(pde_t *pgdir, uint sz) {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if ((d = setupkvm()) == 0)
     return 0;
   for (i = 0; i < sz; i += PGSIZE) {
+    // Pages inside sz that were never touched (lazy sbrk) have no
+    // mapping; the child will fault them in on demand too.
     if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+      continue;
+    // Bring paged-out pages back so parent and child can share them.
+    if ((*pte & PTE_SWAP) && swapfault(pgdir, i) < 0)
+      goto bad;
     if (!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    // Writable pages become read-only COW in both parent and child;
+    // pages that were already read-only (text) are shared as-is.
+    if (*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char *)P2V(pa), PGSIZE);
-    if (mappages(d, (void *)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    krefinc(P2V(pa));
+    if (mappages(d, (void *)i, PGSIZE, pa, flags) < 0) {
+      kfree(P2V(pa));
       goto bad;
     }
   }
+  // Flush stale writable translations for the parent's pages.
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
   freevm(d);
+  lcr3(V2P(pgdir));
   return 0;
 }
 
+// Back a lazily allocated page at va with a zeroed frame.  sbrk only
+// grows proc->sz; the first touch of each new heap page lands here.
+// Returns 0 on success, -1 if va is already mapped or memory is
+// exhausted.  The caller checks that va is below the process size.
+int lazyfault(pde_t *pgdir, uint va) {
+  pte_t *pte;
+  char *mem;
+
+  if (va >= KERNBASE)
+    return -1;
+  pte = walkpgdir(pgdir, (void *)va, 0);
+  if (pte && (*pte & PTE_P))
+    return -1;
+  if ((mem = kalloczero()) == 0 && swapout() > 0)
+    mem = kalloczero();
+  if (mem == 0) {
+    cprintf("lazyfault out of memory\n");
+    return -1;
+  }
+  if (mappages(pgdir, (char *)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W | PTE_U) <
+      0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Resolve a write fault on a copy-on-write page at va in pgdir.
+// If the faulting process is the last referencer, the page is simply
+// made writable again; otherwise it gets a private copy.  Returns 0
+// on success, -1 if va is not a COW page or memory is exhausted.
+int cowfault(pde_t *pgdir, uint va) {
+  pte_t *pte;
+  char *mem;
+  uint pa;
+
+  if (va >= KERNBASE)
+    return -1;
+  if ((pte = walkpgdir(pgdir, (void *)va, 0)) == 0)
+    return -1;
+  if ((*pte & (PTE_P | PTE_U | PTE_COW)) != (PTE_P | PTE_U | PTE_COW))
+    return -1;
+
+  pa = PTE_ADDR(*pte);
+  if (krefcount(P2V(pa)) == 1) {
+    // Sole owner; reclaim write permission in place.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  } else {
+    if ((mem = kalloc()) == 0 && swapout() > 0)
+      mem = kalloc();
+    if (mem == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W);
+    kfree(P2V(pa));
+  }
+  // Flush the stale entry, but only if pgdir is actually loaded:
+  // uva2ka can break COW in a page table that is not current.
+  if (rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Evict up to max of p's resident user pages to swap slots.  A clock
+// pass: pages with the hardware accessed bit set get the bit cleared
+// and survive this round, so recently touched pages go last; a second
+// pass takes pages regardless.  Only private writable pages leave:
+// shared COW frames would need every referencing page table patched,
+// and read-only text is cheaper to re-read from the executable
+// (execfault) than from swap.  The caller (swapout) has arranged via
+// swapvictim() that p cannot run and its page table is in no cpu's
+// cr3, so PTEs can be rewritten without TLB shootdown.
+int swapoutproc(struct proc *p, int max) {
+  pte_t *pte;
+  uint a, pa;
+  int pass, slot, n = 0;
+
+  for (pass = 0; pass < 2 && n < max; pass++) {
+    for (a = 0; a < p->sz && n < max; a += PGSIZE) {
+      if ((pte = walkpgdir(p->pgdir, (char *)a, 0)) == 0) {
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if ((*pte & (PTE_P | PTE_U | PTE_W)) != (PTE_P | PTE_U | PTE_W) ||
+          (*pte & PTE_COW))
+        continue;
+      pa = PTE_ADDR(*pte);
+      if (krefcount(P2V(pa)) != 1)
+        continue;
+      if (pass == 0 && (*pte & PTE_A)) {
+        *pte &= ~PTE_A;
+        continue;
+      }
+      if ((slot = swapalloc()) < 0)
+        return n;
+      swapwrite(slot, P2V(pa));
+      *pte = ((uint)slot << 12) | PTE_SWAP | PTE_W | PTE_U;
+      kfree(P2V(pa));
+      n++;
+    }
+  }
+  return n;
+}
+
+// Bring the paged-out page at va back into a fresh frame.  Returns 0
+// on success, -1 if va is not swapped or memory is truly exhausted.
+// No TLB flush is needed: the entry was not present, and x86 does not
+// cache not-present translations.
+int swapfault(pde_t *pgdir, uint va) {
+  pte_t *pte;
+  char *mem;
+  int slot;
+
+  if (va >= KERNBASE)
+    return -1;
+  if ((pte = walkpgdir(pgdir, (void *)va, 0)) == 0)
+    return -1;
+  if ((*pte & (PTE_P | PTE_SWAP)) != PTE_SWAP)
+    return -1;
+  slot = *pte >> 12;
+  if ((mem = kalloc()) == 0 && swapout() > 0)
+    mem = kalloc();
+  if (mem == 0)
+    return -1;
+  swapread(slot, mem);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & (PTE_U | PTE_W)) | PTE_P;
+  swapfree(slot);
+  return 0;
+}
+
+// Is va backed by a present PTE in pgdir?  Lets fault handlers tell
+// a protection fault on an existing mapping from a missing page.
+int uvamapped(pde_t *pgdir, uint va) {
+  pte_t *pte = walkpgdir(pgdir, (void *)va, 0);
+
+  return pte != 0 && (*pte & PTE_P);
+}
+
 // PAGEBREAK!
 // Map user virtual address to kernel address.
 char *uva2ka(pde_t *pgdir, char *uva) {
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
+  if (pte == 0)
+    return 0;
+  // Callers access the frame through its kernel address, which never
+  // faults; paged-out pages must come back first.
+  if ((*pte & PTE_SWAP) && swapfault(pgdir, (uint)uva) < 0)
+    return 0;
   if ((*pte & PTE_P) == 0)
     return 0;
   if ((*pte & PTE_U) == 0)
     return 0;
+  // Callers write through the returned kernel address, so shared
+  // copy-on-write pages must be broken here.
+  if ((*pte & PTE_COW) && cowfault(pgdir, (uint)uva) < 0)
+    return 0;
   return (char *)P2V(PTE_ADDR(*pte));
 }
 
@@ -14,6 +14,13 @@ static inline void insl(int port, void *addr, int cnt) {
                : "memory", "cc");
 }
 
+static inline uint indw(ushort port) {
+  uint data;
+
+  asm volatile("in %1,%0" : "=a"(data) : "d"(port));
+  return data;
+}
+
 static inline void outb(ushort port, uchar data) {
   asm volatile("out %0,%1" : : "a"(data), "d"(port));
 }
@@ -33,6 +40,20 @@ static inline void outsl(int port, const void *addr, int cnt) {
                : "cc");
 }
 
+static inline void movsb(void *dst, const void *src, int cnt) {
+  asm volatile("cld; rep movsb"
+               : "=D"(dst), "=S"(src), "=c"(cnt)
+               : "0"(dst), "1"(src), "2"(cnt)
+               : "memory", "cc");
+}
+
+static inline void movsl(void *dst, const void *src, int cnt) {
+  asm volatile("cld; rep movsl"
+               : "=D"(dst), "=S"(src), "=c"(cnt)
+               : "0"(dst), "1"(src), "2"(cnt)
+               : "memory", "cc");
+}
+
 static inline void stosb(void *addr, int data, int cnt) {
   asm volatile("cld; rep stosb"
                : "=D"(addr), "=c"(cnt)
@@ -87,6 +108,17 @@ static inline void cli(void) { asm volatile("cli"); }
 
 static inline void sti(void) { asm volatile("sti"); }
 
+static inline void hlt(void) { asm volatile("hlt"); }
+
+// MSRs for the sysenter/sysexit fast syscall path.
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static inline void wrmsr(uint msr, uint lo, uint hi) {
+  asm volatile("wrmsr" : : "c"(msr), "a"(lo), "d"(hi));
+}
+
 static inline uint xchg(volatile uint *addr, uint newval) {
   uint result;
 
@@ -98,16 +130,75 @@ static inline uint xchg(volatile uint *addr, uint newval) {
   return result;
 }
 
+static inline uint xadd(volatile uint *addr, uint incr) {
+  asm volatile("lock; xaddl %0, %1" : "+r"(incr), "+m"(*addr) : : "cc");
+  return incr;
+}
+
+static inline uint rdtsc(void) {
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return lo;
+}
+
+static inline void rdtsc64(uint *lo, uint *hi) {
+  asm volatile("rdtsc" : "=a"(*lo), "=d"(*hi));
+}
+
+static inline uint rcr0(void) {
+  uint val;
+  asm volatile("movl %%cr0,%0" : "=r"(val));
+  return val;
+}
+
+static inline void lcr0(uint val) {
+  asm volatile("movl %0,%%cr0" : : "r"(val));
+}
+
+static inline void clts(void) { asm volatile("clts"); }
+
+static inline void fninit(void) { asm volatile("fninit"); }
+
+static inline void ldmxcsr(uint mxcsr) {
+  asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+// addr must be 16-byte aligned (see fpstate in struct proc).
+static inline void fxsave(void *addr) {
+  asm volatile("fxsave (%0)" : : "r"(addr) : "memory");
+}
+
+static inline void fxrstor(void *addr) {
+  asm volatile("fxrstor (%0)" : : "r"(addr));
+}
+
 static inline uint rcr2(void) {
   uint val;
   asm volatile("movl %%cr2,%0" : "=r"(val));
   return val;
 }
 
+static inline uint rcr3(void) {
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r"(val));
+  return val;
+}
+
 static inline void lcr3(uint val) {
   asm volatile("movl %0,%%cr3" : : "r"(val));
 }
 
+static inline uint rcr4(void) {
+  uint val;
+  asm volatile("movl %%cr4,%0" : "=r"(val));
+  return val;
+}
+
+static inline void lcr4(uint val) {
+  asm volatile("movl %0,%%cr4" : : "r"(val));
+}
+
 // PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().